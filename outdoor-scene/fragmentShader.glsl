@@ -1,33 +1,59 @@
 #version 330 core
 
+// OBJ, USE_FOG, USE_TEXTURE and GROUND_LAYER select the variant, they are defined by the program loader
+#define TEXTURED (USE_TEXTURE && (OBJ == OBJ_GROUND || OBJ == OBJ_SKY || OBJ == OBJ_TERRAIN))
+
+// uniform blocks - the same declarations as in the vertex shader
+layout (std140) uniform FrameUniforms {
+	mat4 view;
+	mat4 proj;
+	vec4 viewPos;
+	vec4 sunlightPos;
+	vec4 sunlightColor;
+	vec4 eyePos;
+	vec4 fogSplat;		// fog start, fog end, splat map scale, splat map offset
+};
+layout (std140) uniform ObjectUniforms {
+	mat4 model;
+	vec4 vColor;
+	vec4 params;		// terrain: level of detail distance, morph ratio
+						// impostor: bounds center height, half width, half height, views
+};
+
 // uniform locations
-uniform vec3 vColor;
-uniform vec3 viewPos;
 uniform sampler2D ourTexture;
-uniform vec3 sunlightPos;
-uniform vec3 sunlightColor;
-uniform bool useTexture;
-uniform bool useFog;
-uniform float fogStart;
-uniform float fogEnd;
+uniform sampler2DArray groundTextures;
+uniform sampler2D splatMap;
+uniform sampler2DArray impostorAtlas;
 
 // outputs and inputs
-out vec4 fragColor;
+layout (location = 0) out vec4 fragColor;
+#if OBJ == OBJ_TREE
+layout (location = 1) out vec4 fragNormal;
+#endif
 in vec3 vNormal;
 in vec3 vPos;
 in vec2 vTexCoord;
-in float textureFlag;
-in float sunlightEffect;
 in vec4 viewSpace;
+in vec3 vertexColor;
 
 // global variables
 float fogDensity = 0.1f;
 vec4 fogColor = vec4(0.5, 0.5, 0.5, 0.5);
 
+// share of the diffuse sunlight per object class
+#if OBJ == OBJ_SKY
+const float sunlightEffect = 0.2;
+#elif OBJ == OBJ_GLUT || OBJ == OBJ_TREE || OBJ == OBJ_IMPOSTOR
+const float sunlightEffect = 0.4;
+#else
+const float sunlightEffect = 1.0;
+#endif
+
 // calculate fog factor of the fragment
 float calculateFogFactor(float fogDistance) {
 	float result = 0.0;
-	result = (fogDistance - fogStart) / (fogEnd - fogStart);
+	result = (fogDistance - fogSplat.x) / (fogSplat.y - fogSplat.x);
 
 	return clamp(result, 0.0, 1.0);
 }
@@ -36,28 +62,59 @@ float calculateFogFactor(float fogDistance) {
 void main(void) {
 	// diffuse light component calculation
 	vec3 normal = normalize(vNormal);
+	vec3 albedo = vColor.rgb * vertexColor;
+
+#if OBJ == OBJ_IMPOSTOR
+	// impostors: color and normal of the baked view, divided by the coverage the filtering mixed in
+	vec4 baked = texture(impostorAtlas, vec3(vTexCoord, 0.0));
+	if (baked.a < 0.5)
+		discard;
+	albedo = baked.rgb / baked.a;
+	vec4 bakedNormal = texture(impostorAtlas, vec3(vTexCoord, 1.0));
+	normal = normalize(bakedNormal.xyz / bakedNormal.a * 2.0 - 1.0);
+#elif OBJ == OBJ_TREE
+	// impostor bake: color and normal go to the atlas, the impostors are lit when drawn
+	fragColor = vec4(albedo, 1.0);
+	fragNormal = vec4(normal * 0.5 + 0.5, 1.0);
+	return;
+#endif
 
 	// sunlight ambient
 	vec3 sunlightAmbient = vec3(0.5, 0.5, 0.5);
 	
 	// sunlight diffuse
-	vec3 sunlightDirection  = normalize(sunlightPos - vPos);
-	float dist = distance(sunlightPos, vPos);
-	vec3 sunlightDiffuse = max(dot(normal, sunlightDirection), 0.0) * (sunlightColor * sunlightEffect);
+	vec3 sunlightDirection  = normalize(sunlightPos.xyz - vPos);
+	float dist = distance(sunlightPos.xyz, vPos);
+	vec3 sunlightDiffuse = max(dot(normal, sunlightDirection), 0.0) * (sunlightColor.rgb * sunlightEffect);
 
 	// combined sunlight
 	vec3 sunlight = sunlightAmbient + sunlightDiffuse;
 
 	// final fragment color
 	float attenuation = 10.0 / dist;
-	fragColor = attenuation * vec4(sunlight * vColor, 1.0);
-	fragColor = useTexture && textureFlag == 1.0
-		? texture(ourTexture, vTexCoord) * fragColor
-		: fragColor;
+	fragColor = attenuation * vec4(sunlight * albedo, 1.0);
+
+#if TEXTURED
+#if OBJ == OBJ_TERRAIN
+	// terrain samples its material from the ground array, blended by the splat map unless one layer is chosen
+#if GROUND_LAYER < 0
+	vec4 weight = texture(splatMap, vPos.xz * fogSplat.z + fogSplat.w);
+	vec4 texel = weight.x * texture(groundTextures, vec3(vTexCoord, 0))
+		+ weight.y * texture(groundTextures, vec3(vTexCoord, 1))
+		+ weight.z * texture(groundTextures, vec3(vTexCoord, 2))
+		+ weight.w * texture(groundTextures, vec3(vTexCoord, 3));
+#else
+	vec4 texel = texture(groundTextures, vec3(vTexCoord, GROUND_LAYER));
+#endif
+#else
+	vec4 texel = texture(ourTexture, vTexCoord);
+#endif
+	fragColor = texel * fragColor;
+#endif
 
+#if USE_FOG
 	// fog
-	if (useFog) {
-		float fogDistance = length(viewSpace);
-		fragColor = mix(fragColor, fogColor, calculateFogFactor(fogDistance));
-	}
-}
\ No newline at end of file
+	float fogDistance = length(viewSpace);
+	fragColor = mix(fragColor, fogColor, calculateFogFactor(fogDistance));
+#endif
+}
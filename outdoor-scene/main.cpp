@@ -1,68 +1,282 @@
-#include <gl/glew.h>
-#include <gl/freeglut.h>
+#include <GL/glew.h>
+#include <GL/freeglut.h>
 // GLM library - for matrix manipulation
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 // Copy the GLM folder to the "include" folder of Visual C++
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <string>
+#include <thread>
+#include <vector>
+// SSE / AVX intrinsics for the terrain normal pass, other CPUs use the scalar path
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TERRAIN_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TERRAIN_SIMD_WIDTH 4
+#endif
+// memory-mapped files and directories for the terrain cache
+#include <sys/stat.h>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+// swap interval for the frame scheduler
+#include <GL/glx.h>
+#endif
 // library to read image files
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 // global constants
+// WORLD_SIZE is the size of the hand-placed scene and the default terrain size
 #define WORLD_SIZE 65
 #define MAX_HEIGHT 5.0
 #define ROUGHNESS 1.5
 
+#if defined(_MSC_VER)
 #pragma warning(disable:4996)
+#endif
 
 // --------------------------------------------------------------------------------
 // Global variables
 // --------------------------------------------------------------------------------
 
 // OpenGL variables
-enum Background { BG_WATER, BG_TERRAIN, BG_SKY, BG_LENGTH };
+enum Background { BG_WATER, BG_SKY, BG_LENGTH };
 
-const int VAO_SIZE = BG_LENGTH + 1;
-const int GLUT_OBJ = VAO_SIZE - 1;
+const int VAO_SIZE = BG_LENGTH + 2;
+const int GLUT_OBJ = VAO_SIZE - 2;
+const int TREE_OBJ = VAO_SIZE - 1;
 
 GLuint VAO[VAO_SIZE];
 GLuint VBO[VAO_SIZE];
+// program of the current draw, one of "shaderVariants"
 GLuint program;
 
-// terrain
-struct terrain { glm::vec3 vertex; glm::vec3 normal; glm::vec2 tex_coord; };
-const int QUADS_PER_DIMENSION = WORLD_SIZE - 1;
-const int VERTICES = QUADS_PER_DIMENSION * QUADS_PER_DIMENSION * 4;
+// typed uniform handle, resolved once after the program is linked
+template <typename T> struct Uniform { GLint location = -1; };
+
+// uniform table of "program" - draw functions use these instead of glGetUniformLocation
+// uniforms a variant does not use keep location -1, so setting them is a no-op
+// only the samplers are plain uniforms, everything else lives in the uniform blocks below
+struct ProgramUniforms {
+	Uniform<int> ourTexture, groundTextures, splatMap, impostorAtlas;
+};
+ProgramUniforms uniforms;
+
+// uniform blocks (std140) - FrameUniforms is written once per frame, ObjectUniforms once per draw
+// both are carved out of "uniformRing", a buffer of UNIFORM_RING_REGIONS regions used round-robin with a fence
+// after each region, so the CPU never writes into a region the GPU may still read
+// persistently mapped with ARB_buffer_storage, otherwise each block is mapped unsynchronized on its own
+struct frameUniforms {
+	glm::mat4 view, proj;
+	glm::vec4 viewPos, sunlightPos, sunlightColor, eyePos;
+	glm::vec4 fogSplat;		// fog start, fog end, splat map scale, splat map offset
+};
+struct objectUniforms {
+	glm::mat4 model;
+	glm::vec4 color;
+	glm::vec4 params;		// terrain: level of detail distance, morph ratio, unused, ground layer
+							// tree: impostor bake when x > 0, impostor: bounds center height, half width, half height, views
+};
+const GLuint FRAME_UNIFORM_BINDING = 0;
+const GLuint OBJECT_UNIFORM_BINDING = 1;
+const int UNIFORM_RING_REGIONS = 3;
+const GLsizeiptr UNIFORM_RING_REGION_SIZE = 1 << 20;
+GLuint uniformRing;
+unsigned char* uniformRingMapping = NULL;
+GLsync uniformRingFences[UNIFORM_RING_REGIONS];
+int uniformRingRegion = 0;
+GLintptr uniformRingOffset = 0;
+GLint uniformRingAlignment = 256;
 
-float heightField[WORLD_SIZE][WORLD_SIZE];
-glm::vec3 vertexCoord[WORLD_SIZE][WORLD_SIZE];
-glm::vec3 vertexNormal[WORLD_SIZE][WORLD_SIZE];
-struct terrain ground[VERTICES];
+// terrain
+// size is chosen at startup (2^n + 1), the terrain is drawn as chunks of CHUNK_QUADS x CHUNK_QUADS quads
+// which are built and uploaded when the camera comes close and evicted when it moves away
+// morph - height of the vertex on the next coarser level, level at which the vertex vanishes
+struct terrain { glm::vec3 vertex; glm::vec3 normal; glm::vec2 tex_coord; glm::vec2 morph; };
+const int CHUNK_QUADS = 32;
+const int CHUNK_SIZE = CHUNK_QUADS + 1;
+// one shared vertex per height sample, one triangle strip per row of quads
+// followed by a skirt - a copy of each edge sample SKIRT_DEPTH lower, one strip per edge
+const int CHUNK_GRID_VERTICES = CHUNK_SIZE * CHUNK_SIZE;
+const int CHUNK_VERTICES = CHUNK_GRID_VERTICES + 4 * CHUNK_SIZE;
+const float SKIRT_DEPTH = 1.0f;
+const GLushort RESTART_INDEX = 0xFFFF;
+
+// terrain level of detail - level N draws every 2^N-th sample of a chunk
+// a chunk uses level N up to LOD_DISTANCE * (2^(N+1) - 1), a vertex that vanishes at level N+1 slides to
+// the level N+1 surface over the last LOD_MORPH_RATIO of that range measured from the vertex itself,
+// so two chunks move a vertex they share the same way
+const int TERRAIN_LODS = 4;
+constexpr float LOD_DISTANCE = 40.0f;
+constexpr float LOD_MORPH_RATIO = 0.3f;
+// a chunk must end before the vertices of the next level start to morph, otherwise its fine vertices
+// stay on the unmorphed coarse edge while the coarser neighbour moves it - with level 0 the tightest case,
+// the chunk diagonal has to fit in 2 * LOD_DISTANCE * (1 - LOD_MORPH_RATIO), which also keeps neighbours
+// within one level
+static_assert(2.0f * CHUNK_QUADS * CHUNK_QUADS < 4.0f * LOD_DISTANCE * LOD_DISTANCE * (1.0f - LOD_MORPH_RATIO) * (1.0f - LOD_MORPH_RATIO),
+	"terrain chunks are too large for the level of detail ranges");
+const float STREAM_DISTANCE = 200.0f;
+const int MAX_CHUNK_BUILDS_PER_FRAME = 8;
+const size_t MAX_POOLED_CHUNKS = 64;
+
+struct terrainChunk { GLuint VAO; GLuint VBO; int chunkX, chunkZ; float minHeight, maxHeight; };
+
+int worldSize = WORLD_SIZE;
+unsigned int terrainSeed = 1;
+int chunksPerDimension;
+std::vector<float> heightField;
+// heights read by the scene - "heightField" while the terrain is generated, the terrain cache mapping once that is
+// loaded, so the OS pages heights in as the camera moves instead of the whole field staying resident
+const float* terrainHeights = NULL;
+std::vector<glm::vec3> vertexNormal;
+std::vector<GLushort> groundIndices;
+GLsizei lodIndexCount[TERRAIN_LODS];
+size_t lodIndexOffset[TERRAIN_LODS];
+GLuint terrainEBO;
+std::map<std::pair<int, int>, terrainChunk> chunks;
+std::vector<terrainChunk> chunkPool;
+
+// generated data that later runs reuse - terrain and transcoded textures
+const char CACHE_DIR[] = "cache";
+
+// terrain cache - one file per seed and world size holding the height field and the packed vertices of every
+// chunk, later runs map it and upload chunks straight from the mapping
+// the header repeats every generation parameter, a file whose header does not match is regenerated
+const uint32_t TERRAIN_CACHE_VERSION = 2;
+const float TERRAIN_CORNERS[4] = { 5.0f, 1.0f, -5.0f, 5.0f };
+struct terrainCacheHeader {
+	char magic[4];
+	uint32_t version, seed;
+	int32_t worldSize, chunkQuads, terrainLods, vertexSize;
+	float maxHeight, roughness, corners[4];
+	uint32_t reserved;
+	uint64_t heightOffset, vertexOffset, fileSize;
+};
+struct mappedFile {
+	const char* data;
+	size_t size;
+#if defined(_WIN32)
+	HANDLE file, mapping;
+#else
+	int file;
+#endif
+};
+mappedFile terrainCache = {};
+const terrain* cachedChunkVertices = NULL;
 
-// water
+// water - scaled by terrain size
 // vertex coord X Y Z, normal vector X Y Z, texture coord S T)
 float water[] = {
-	-WORLD_SIZE / 2.0f, 0.0f, -WORLD_SIZE / 2.0f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f,
-	-WORLD_SIZE / 2.0f, 0.0f, +WORLD_SIZE / 2.0f,	0.0f, 1.0f, 0.0f,	0.0f, 1.0f,
-	+WORLD_SIZE / 2.0f, 0.0f, +WORLD_SIZE / 2.0f,	0.0f, 1.0f, 0.0f,	1.0f, 1.0f,
-	+WORLD_SIZE / 2.0f, 0.0f, -WORLD_SIZE / 2.0f,	0.0f, 1.0f, 0.0f,	1.0f, 0.0f,
+	-0.5f, 0.0f, -0.5f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f,
+	-0.5f, 0.0f, +0.5f,	0.0f, 1.0f, 0.0f,	0.0f, 1.0f,
+	+0.5f, 0.0f, +0.5f,	0.0f, 1.0f, 0.0f,	1.0f, 1.0f,
+	+0.5f, 0.0f, -0.5f,	0.0f, 1.0f, 0.0f,	1.0f, 0.0f,
 };
 
 // sky
 glm::vec3 skyColor = glm::vec3(3.0f, 3.0f, 3.0f);
-// vertex coord X Y Z, normal vector X Y Z
+// vertex coord X Y Z, normal vector X Y Z - scaled by SKY_DISTANCE and moved with the camera, so any world size
+// sees the backdrop of the hand-placed scene; the farthest corner is about 1.6 * SKY_DISTANCE away, inside the far plane
+const float SKY_DISTANCE = WORLD_SIZE;
 float sky[] = {
-	-WORLD_SIZE, +WORLD_SIZE / 1.50f, -WORLD_SIZE / 2.0f,	0.0f, 0.0f, 1.0f,	0.0f, 0.0f,
-	-WORLD_SIZE, -WORLD_SIZE / 15.0f, -WORLD_SIZE / 2.0f,	0.0f, 0.0f, 1.0f,	0.0f, 1.0f,
-	+WORLD_SIZE, -WORLD_SIZE / 15.0f, -WORLD_SIZE / 2.0f,	0.0f, 0.0f, 1.0f,	1.0f, 1.0f,
-	+WORLD_SIZE, +WORLD_SIZE / 1.50f, -WORLD_SIZE / 2.0f,	0.0f, 0.0f, 1.0f,	1.0f, 0.0f,
+	-1.0f, +1.0f / 1.50f, -0.5f,	0.0f, 0.0f, 1.0f,	0.0f, 0.0f,
+	-1.0f, -1.0f / 15.0f, -0.5f,	0.0f, 0.0f, 1.0f,	0.0f, 1.0f,
+	+1.0f, -1.0f / 15.0f, -0.5f,	0.0f, 0.0f, 1.0f,	1.0f, 1.0f,
+	+1.0f, +1.0f / 1.50f, -0.5f,	0.0f, 0.0f, 1.0f,	1.0f, 0.0f,
+};
+
+// baked mesh - vertex coord X Y Z, normal vector X Y Z, color R G B
+struct meshVertex { glm::vec3 vertex; glm::vec3 normal; glm::vec3 color; };
+
+// mesh cache - every tessellation of a primitive is generated once, the first time its (shape, size, height,
+// slices) is asked for, and stays resident in the buffers of VAO[GLUT_OBJ]; new meshes are appended on the CPU
+// and the buffers are uploaded again before the next draw
+// animal parts draw cached meshes directly, the tree levels of detail are assembled from cached meshes and added
+// to the cache as meshes of their own, colored per vertex
+// stacks are not part of the key, the straight sides of the baked cones and cylinders need only one stack
+enum Shape { SHAPE_CUBE, SHAPE_CONE, SHAPE_CYLINDER, SHAPES };
+struct meshKey {
+	Shape shape;
+	float size, height;
+	int slices;
+	bool operator<(const meshKey& other) const {
+		if (shape != other.shape) return shape < other.shape;
+		if (size != other.size) return size < other.size;
+		if (height != other.height) return height < other.height;
+		return slices < other.slices;
+	}
 };
+struct meshRange { GLsizei indexCount; GLuint firstIndex; GLint baseVertex; GLsizei vertexCount; };
+std::map<meshKey, int> meshIds;
+std::vector<meshRange> cachedMeshes;
+std::vector<meshVertex> meshCacheVertices;
+std::vector<GLuint> meshCacheIndices;
+bool meshCacheDirty = false;
+
+// parts - the parts of every animal and the trees drawn as meshes are queued with a cached mesh, their transform
+// and color during the frame and drawn together by "drawParts"
+// per part instance: model matrix (attributes 6 - 9) and color (attribute 10)
+// one indirect command per mesh in a single glMultiDrawElementsIndirect, or one instanced draw per mesh
+// when the driver lacks multi-draw indirect and base instance
+struct partInstance { glm::mat4 model; glm::vec4 color; };
+struct drawElementsIndirectCommand { GLuint count, instanceCount, firstIndex; GLint baseVertex; GLuint baseInstance; };
+std::vector<std::vector<partInstance>> queuedParts;
+std::vector<partInstance> partInstances;
+std::vector<drawElementsIndirectCommand> partCommands;
+GLuint partEBO, partInstanceVBO, partIndirectBuffer;
+bool useMultiDrawIndirect = false;
+
+// level of detail - objects pick their level from their projected size in pixels, and change level only once the
+// size is "LOD_HYSTERESIS" past a threshold so objects near a boundary do not pop back and forth
+const float LOD_HYSTERESIS = 0.15f;
+float lodPixelScale = 1.0f;
+
+// trees - per tree: position X Y Z, scale
+// the tree mesh is baked once per level of detail into the mesh cache and each tree is queued as a part
+// the last level is the impostor quad, drawn instanced and used only if the impostor atlas could be baked
+const int TREE_MESH_LODS = 3;
+const int TREE_LODS = TREE_MESH_LODS + 1;
+const int TREE_LOD_SLICES[TREE_MESH_LODS] = { 50, 16, 6 };
+const float TREE_LOD_PIXELS[TREE_LODS - 1] = { 200.0f, 80.0f, 40.0f };
+int treeLodCount = TREE_MESH_LODS;
+int treeMeshes[TREE_MESH_LODS];
+GLuint treeEBO, treeInstanceVBO;
+std::vector<glm::vec4> treeInstances;
+std::vector<unsigned char> treeLevels;
+std::vector<glm::vec4> lodTrees[TREE_LODS];
+int extraTrees = 0;
+// bounding sphere of the baked tree mesh in tree space, scaled per instance
+const glm::vec3 TREE_BOUNDS_CENTER = glm::vec3(0.0f, 0.5f, 0.0f);
+const float TREE_BOUNDS_RADIUS = 3.4f;
 
-// trees
 const int NUM_OF_TREES = 10;
 const glm::vec3 treesCoord[NUM_OF_TREES] = {
 	glm::vec3(-30.0, +5.0, -10.0),
@@ -77,27 +291,44 @@ const glm::vec3 treesCoord[NUM_OF_TREES] = {
 	glm::vec3(+30.0, +3.5, -10.0),
 };
 
-// ducks
-const int NUM_OF_DUCKS = 2;
-glm::vec4 ducksCoord[NUM_OF_DUCKS] = {
-	glm::vec4(WORLD_SIZE / 5, 0, 0, 0),
-	glm::vec4(0, 0, WORLD_SIZE / 5, 0),
+// animals
+// every animal of every species lives in one structure-of-arrays store, one array per property indexed by
+// animal, so "updateAnimals" runs each step as a plain loop over contiguous floats the compiler can vectorize
+// animals walk along X between "minX" and "maxX" and turn around at the ends, ducks also wobble
+enum Species { SPECIES_DUCK, SPECIES_GOAT, SPECIES };
+struct speciesInfo { float boundsHeight, boundsRadius, wobble; };
+const speciesInfo speciesInfos[SPECIES] = {
+	{ 1.0f, 2.0f, 5.0f },	// duck
+	{ 1.5f, 2.5f, 0.0f },	// goat
 };
-int ducksDirection[NUM_OF_DUCKS] = { 1 };
-
-// goats
-const int NUM_OF_GOATS = 2;
-glm::vec3 goatsCoord[NUM_OF_GOATS] = {
-	glm::vec3(-WORLD_SIZE / 3, 1.5f, -WORLD_SIZE / 10),
-	glm::vec3(-WORLD_SIZE / 4, 1.7f, +WORLD_SIZE / 10),
+// "previousX" and "previousRotation" hold the state of the last simulation step for interpolation
+// speed in units per second, ducks rock between -wobble and +wobble degrees once per WOBBLE_PERIOD seconds
+const float ANIMAL_SPEED = 2.5f;
+const float WOBBLE_PERIOD = 0.8f;
+struct animalStore {
+	std::vector<unsigned char> species, level;
+	std::vector<float> x, y, z, previousX;
+	std::vector<float> heading, speed, rotation, previousRotation, wobble;
+	std::vector<float> minX, maxX;
+	std::vector<float> boundsHeight, boundsRadius;
 };
-int goatsDirection[NUM_OF_GOATS] = { 1 };
+animalStore animals;
+int extraAnimals = 0;
+
+// animals drop their eyes, beaks and horns below "ANIMAL_DETAIL_PIXELS"
+const int ANIMAL_LODS = 2;
+const float ANIMAL_DETAIL_PIXELS[ANIMAL_LODS - 1] = { 24.0f };
 
 // predefined matrix type from GLM
 glm::mat4 model;
 glm::mat4 view;
 glm::mat4 proj;
 
+// view-frustum culling - planes of proj * view (A B C D, normal points inside) and counters for the menu
+glm::vec4 frustumPlanes[6];
+int culledObjects = 0, totalObjects = 0;
+int culledChunks = 0, totalChunks = 0;
+
 // camera position and facing direction
 GLfloat camX = 0.0f;
 GLfloat camY = MAX_HEIGHT * 1.0f;
@@ -105,6 +336,12 @@ GLfloat camZ = WORLD_SIZE / 2.0f;
 GLfloat dirX = 0.0f;
 GLfloat dirY = MAX_HEIGHT / 2.0f;
 GLfloat dirZ = 0.0f;
+// the arrow keys move the camera over the whole terrain and keep its height above the ground (or the water),
+// page up / page down change that height within [CAMERA_MIN_HEIGHT, CAMERA_MAX_HEIGHT]
+// a step is 0.5 on the hand-placed world and grows with the world size up to CAMERA_MAX_STEP
+const float CAMERA_MIN_HEIGHT = 2.0f;
+const float CAMERA_MAX_HEIGHT = 10.0f;
+const float CAMERA_MAX_STEP = 16.0f;
 
 GLfloat supermanCamX = 0.0f;
 GLfloat supermanCamY = WORLD_SIZE / 2.5f;
@@ -112,324 +349,2470 @@ GLfloat supermanCamZ = 0.0f;
 GLfloat supermanDirX = 0.0f;
 GLfloat supermanDirY = 0.0f;
 GLfloat supermanDirZ = 0.0f;
-float supermanCircle = 0.0f;
+float supermanCircle = 0.0f, previousSupermanCircle = 0.0f;
 const float increment = 2 * 3.142 / 360.0f;
+// radians per second
+const float SUPERMAN_SPEED = increment * 10.0f;
 
 // light
 glm::vec3 sunlightPos = { 0, WORLD_SIZE, WORLD_SIZE / 5.0f };
 glm::vec3 sunlightColor = { 1.0f, 1.0f, 1.0f };
+// the sun crosses the scene along X at SUNLIGHT_SPEED units per second, "sunlightPos" holds the drawn position
+// relative to the start of the walking camera and moves along with it, as its light falls off with distance
+const float SUNLIGHT_SPEED = 2.0f;
+float sunlightX = 0.0f, previousSunlightX = 0.0f;
 
 // textures
 enum Texture { TEX_WATER, TEX_GRASS, TEX_FOREST, TEX_SAND, TEX_EARTH, TEX_SKY, TEXTURES };
 unsigned int textureID[TEXTURES];
-unsigned int groundTexture = 1;
+const char* textureFiles[TEXTURES] = {
+	"textures/water.jpg",
+	"textures/grass.jpg",
+	"textures/forest.jpg",
+	"textures/sand.jpg",
+	"textures/earth.jpg",
+	"textures/sky.jpg",
+};
+
+// compressed textures - each JPEG is transcoded once to BC1 (DXT1) with a full mip chain and stored as KTX 1.1
+// in CACHE_DIR, the cached file is rebuilt when the JPEG is newer
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+struct ktxHeader {
+	unsigned char identifier[12];
+	uint32_t endianness, glType, glTypeSize, glFormat, glInternalFormat, glBaseInternalFormat;
+	uint32_t pixelWidth, pixelHeight, pixelDepth, numberOfArrayElements, numberOfFaces, numberOfMipmapLevels;
+	uint32_t bytesOfKeyValueData;
+};
+
+// program binary cache - linked programs are stored in CACHE_DIR by glGetProgramBinary under a hash of their
+// sources and the driver strings, and restored with glProgramBinary on later runs
+struct programCacheHeader {
+	char magic[4];
+	uint32_t format;
+	uint64_t key, size;
+};
+
+// asynchronous texture loading - worker threads read the cached KTX or decode the JPEG of every texture into
+// "textureImages", the GL thread uploads finished images through a pixel buffer object
+// until then each texture is a single texel of "texturePlaceholders"
+struct textureImage {
+	bool compressed;
+	int width, height, levels;
+	std::vector<unsigned char> data;
+	std::vector<size_t> levelOffset;
+	std::atomic<bool> ready;
+	bool uploaded;
+};
+textureImage textureImages[TEXTURES];
+const unsigned char texturePlaceholders[TEXTURES][3] = {
+	{ 60, 90, 200 },
+	{ 110, 150, 50 },
+	{ 60, 100, 40 },
+	{ 200, 180, 130 },
+	{ 120, 90, 60 },
+	{ 110, 160, 220 },
+};
+bool useCompressedTextures = false;
+std::atomic<int> nextTextureJob;
+std::vector<std::thread> textureWorkers;
+
+// ground materials - grass, forest, sand and earth are the layers of one texture array on a single unit,
+// resampled to GROUND_LAYER_SIZE because the images differ in size
+const int GROUND_LAYERS = Texture::TEX_EARTH - Texture::TEX_GRASS + 1;
+const int GROUND_LAYER_SIZE = 1024;
+const int GROUND_TEXTURE_UNIT = Texture::TEX_GRASS;
+GLuint groundArrayTexture;
+// -1 blends the layers by the splat map, 0 to GROUND_LAYERS - 1 covers the terrain with that layer alone
+int groundLayer = -1;
+
+// splat map - per height sample the weight of each ground layer (RGBA in layer order) from its height and slope,
+// at most SPLAT_MAP_MAX_SIZE texels per side so large worlds take every "splatStep"-th sample
+const int SPLAT_MAP_MAX_SIZE = 2049;
+const int SPLAT_TEXTURE_UNIT = Texture::TEXTURES;
+const float SAND_HEIGHT = 0.6f;
+const float FOREST_HEIGHT = 3.0f;
+const float EARTH_SLOPE = 0.8f;
+GLuint splatTexture;
+int splatSize, splatStep;
+
+// impostors - a distant tree is one quad turned to the camera about its vertical axis, showing the closest of
+// IMPOSTOR_VIEWS views around the tree; the views are rendered at startup into an atlas with the color and
+// coverage in layer 0 and the normal in layer 1, so the impostors are lit by the current sun like the meshes
+const int IMPOSTOR_VIEWS = 16;
+const int IMPOSTOR_TILE_WIDTH = 64;
+const int IMPOSTOR_TILE_HEIGHT = 128;
+const int IMPOSTOR_TEXTURE_UNIT = SPLAT_TEXTURE_UNIT + 1;
+// half width and half height of the tree mesh around TREE_BOUNDS_CENTER
+const glm::vec2 IMPOSTOR_HALF_SIZE = glm::vec2(1.6f, 3.0f);
+GLuint impostorTexture;
 
 // frames-per-second (FPS)
 int renderCounter = 0, s_time = 0, e_time = 0;
+
+// simulation - one fixed-step clock moves the water, sun, animals and Superman camera; every frame runs the
+// steps that fell due since the last frame (at most MAX_SIM_CATCH_UP_MS worth after a stall) and draws the
+// state blended between the last two steps by "simAlpha", so motion is smooth at any frame rate
+const int SIM_STEP_MS = 20;
+const float SIM_STEP = SIM_STEP_MS / 1000.0f;
+const int MAX_SIM_CATCH_UP_MS = 250;
+const int RIPPLE_INTERVAL_MS = 500;
+int lastSimTime = -1, simAccumulator = 0;
+int simSteps = 0;
+double simTime = 0.0;
+float simAlpha = 1.0f;
+
+// frame scheduler - the idle callback sleeps until the next frame is due instead of redrawing as fast as possible
+// frames are paced to "targetFrameRate" per second (0 paces nothing); with vsync the swap already waits for the
+// display, so a target above the refresh rate just leaves every frame late and the deadline restarts from now
+// instead of piling up; in on-demand mode a frame is drawn when input or a window event asked for one, for every
+// simulation step during ON_DEMAND_ACTIVE_MS after input or while the Superman camera flies, and otherwise only
+// every ON_DEMAND_AMBIENT_MS for the ambient motion (sun, water, animals)
+// the idle sleep is cut into SIM_STEP_MS slices so input still gets through while nothing is drawn
+const int ON_DEMAND_ACTIVE_MS = 1000;
+const int ON_DEMAND_AMBIENT_MS = 200;
+static_assert(ON_DEMAND_AMBIENT_MS <= MAX_SIM_CATCH_UP_MS, "ambient frames must not drop simulation steps");
+int targetFrameRate = 60;
+bool useVsync = true;
+bool useOnDemandRedraw = false;
+bool redrawRequested = true;
+int lastInputTime = 0;
+std::chrono::steady_clock::time_point nextFrameTime;
 float curFPS;
 char curFPSstr[50] = "0.0";
 
-// other options variables
-enum Object { OBJ_NULL, OBJ_GROUND, OBJ_SKY, OBJ_GLUT };
-int object = Object::OBJ_NULL;
-int ripple = 0;
+// other options variables
+enum Object { OBJ_NULL, OBJ_GROUND, OBJ_SKY, OBJ_GLUT, OBJ_TREE, OBJ_TERRAIN, OBJ_IMPOSTOR, OBJECTS };
+int object = Object::OBJ_NULL;
+
+// shader permutations - one program per object class, fog on / off, texture on / off and object mode, specialized
+// by the preprocessor (OBJ, USE_FOG, USE_TEXTURE, GROUND_LAYER) so the shaders do not branch on them
+// objects without a texture share their texture-off program for both texture states
+// modes: the terrain blends the ground layers by the splat map (0) or shows layer mode - 1 alone, every other
+// object class has mode 0 only
+// trees are drawn as parts (OBJ_GLUT) and impostors, OBJ_TREE only bakes the impostor atlas
+const int OBJECT_MODES = GROUND_LAYERS + 1;
+struct shaderVariant { GLuint program; ProgramUniforms uniforms; };
+shaderVariant shaderVariants[OBJECTS][2][2][OBJECT_MODES];
+const char* objectNames[OBJECTS] = { "OBJ_NULL", "OBJ_GROUND", "OBJ_SKY", "OBJ_GLUT", "OBJ_TREE", "OBJ_TERRAIN", "OBJ_IMPOSTOR" };
+
+// shader hot reload - the shader files are watched (inotify on Linux, modification time elsewhere) and every
+// variant is rebuilt from the new sources, in the driver's compiler threads when it supports parallel shader
+// compile - the new set replaces the running one only once every variant has linked
+const char* VERTEX_SHADER_FILE = "vertexShader.glsl";
+const char* FRAGMENT_SHADER_FILE = "fragmentShader.glsl";
+const int SHADER_POLL_INTERVAL = 500;	// ms, modification time polling
+struct pendingProgram { GLuint program, vShaderID, fShaderID; bool cacheable; uint64_t key; };
+pendingProgram pendingVariants[OBJECTS][2][2][OBJECT_MODES];
+bool shaderReloadPending = false;
+bool useParallelShaderCompile = false;
+int shaderWatch = -1;
+time_t shaderFileTimes[2];
+std::chrono::steady_clock::time_point lastShaderPoll;
+int ripple = 0;
+
+bool useSuperman = false;
+bool useAntiAliasing = false;
+bool useTexture = true;
+bool useFog = false;
+
+bool showMenu = false;
+int curTextLoc, startTextLoc;
+
+// benchmark (offscreen rendering with fixed camera path)
+const int BENCHMARK_WIDTH = 1280;
+const int BENCHMARK_HEIGHT = 720;
+const int BENCHMARK_WARMUP = 10;
+bool useBenchmark = false;
+int benchmarkFrames = 0;
+GLuint benchmarkFBO, benchmarkColorRBO, benchmarkDepthRBO;
+
+// --------------------------------------------------------------------------------
+// Function prototypes
+// --------------------------------------------------------------------------------
+
+bool readShaderFile(const std::string&, std::string&);
+std::string infoLog(GLuint, bool);
+uint64_t programCacheKey(const std::string&, const std::string&);
+std::string programCachePath(uint64_t);
+GLuint loadProgramBinary(uint64_t);
+void saveProgramBinary(GLuint, uint64_t);
+void insertDefines(std::string&, const std::string&);
+bool readShaderSources(std::string&, std::string&, std::string&);
+pendingProgram beginProgram(std::string, std::string, const std::string&);
+bool programReady(const pendingProgram&);
+GLuint finishProgram(const pendingProgram&, std::string&);
+bool objectTextured(int);
+int objectModes(int);
+std::string shaderDefines(int, bool, bool, int);
+void beginShaderVariants(const std::string&, const std::string&);
+bool shaderVariantsReady(void);
+bool finishShaderVariants(std::string&);
+void discardShaderVariants(void);
+void initShaderVariants(void);
+void setConstantUniforms(void);
+void initShaderWatch(void);
+bool shaderFilesChanged(void);
+void pollShaderReload(void);
+void useObjectProgram(int, int = 0);
+void forEachVariant(const std::function<void(void)>&);
+void bindUniformBlocks(GLuint);
+void initUniformRing(void);
+void nextUniformRegion(void);
+void writeUniformBlock(GLuint, const void*, GLsizeiptr);
+void setFrameUniforms(void);
+void setObjectUniforms(const glm::mat4&, const glm::vec3&, const glm::vec4& = glm::vec4(0.0f));
+ProgramUniforms reflectUniforms(GLuint);
+void setUniform(Uniform<int>, int);
+void startTextureLoading(void);
+bool isGroundTexture(int);
+int mipLevels(int, int);
+std::vector<unsigned char> loadImage(const char*, int, int&, int&);
+std::vector<unsigned char> halveImage(const std::vector<unsigned char>&, int, int);
+void decodeTexture(int);
+void uploadTexture(int);
+bool pollTextures(void);
+void joinTextureWorkers(void);
+void makeCacheDir(void);
+std::string textureCachePath(const char*);
+bool textureCacheValid(const char*);
+void encodeBC1Block(const unsigned char*, unsigned char*);
+bool transcodeTexture(const char*, int);
+bool readCompressedTexture(const char*, textureImage&);
+float randomize(double);
+float& heightAt(int, int);
+float heightSample(int, int);
+float cellRandom(unsigned int, int, int, int, double);
+void parallelFor(int, int, const std::function<void(int, int)>&);
+void generateTerrain(float, float, float, float, unsigned int);
+void computeNormalRows(int, int);
+void computeNormals(void);
+void initChunkIndices(void);
+int chunkEdgeVertex(int, int);
+void initSplatMap(void);
+terrainChunk acquireChunk(void);
+void releaseChunk(terrainChunk);
+void packChunk(terrain*, int, int);
+void buildChunk(terrainChunk&, int, int);
+bool mapFile(const std::string, mappedFile&);
+void unmapFile(mappedFile&);
+std::string terrainCachePath(void);
+terrainCacheHeader terrainCacheLayout(void);
+bool writeTerrainCache(void);
+bool loadTerrainCache(void);
+float chunkDistance(int, int, glm::vec3);
+int chunkLod(const terrainChunk&, glm::vec3);
+void streamChunks(glm::vec3, int);
+float terrainHeight(float, float);
+float cameraGround(void);
+glm::vec3 eyePosition(void);
+float projectedSize(glm::vec3, float);
+int selectLod(int, float, const float*, int);
+void extractFrustum(glm::mat4);
+bool boxInFrustum(glm::vec3, glm::vec3);
+bool sphereInFrustum(glm::vec3, float);
+void appendCylinder(std::vector<meshVertex>&, std::vector<GLuint>&, glm::mat4, float, float, int, glm::vec3);
+void appendCone(std::vector<meshVertex>&, std::vector<GLuint>&, glm::mat4, float, float, int, glm::vec3);
+void appendCube(std::vector<meshVertex>&, std::vector<GLuint>&, glm::mat4, float, glm::vec3);
+void initTrees(void);
+void addAnimal(Species, glm::vec3, float, float, float);
+void initAnimals(void);
+void initImpostors(void);
+bool bakeImpostors(void);
+int cachedMesh(Shape, float, float, int);
+int addCachedMesh(const std::vector<meshVertex>&, const std::vector<GLuint>&);
+void appendCachedMesh(std::vector<meshVertex>&, std::vector<GLuint>&, int, glm::mat4, glm::vec3);
+void uploadMeshCache(void);
+void initParts(void);
+void setPartAttributes(GLuint);
+void queuePart(int, const glm::mat4&, const glm::vec3&);
+void drawParts(void);
+void init(void);
+void drawWater(void);
+void drawTerrain(void);
+void drawSky(void);
+void drawTrees(void);
+void drawDuck(float, float, float, float, float, bool);
+void drawGoat(float, float, float, float, bool);
+int textLoc(void);
+void drawText(int, int, char*);
+void drawMenu(void);
+void renderScene(void);
+void display(void);
+void setSupermanCamera(float);
+void setSunlight(float);
+void setBenchmarkCamera(int, int);
+void printBenchmarkStats(const char*, std::vector<double>);
+void runBenchmark(int);
+void updateWater(void);
+void updateFPS(void);
+void updateAnimals(void);
+void simulationStep(void);
+void advanceSimulation(void);
+bool setSwapInterval(int);
+void initFramePacing(void);
+void requestRedraw(void);
+void idle(void);
+void specialKey(int, int, int);
+void keyboardKey(unsigned char, int, int);
+int main(int, char**);
+
+// --------------------------------------------------------------------------------
+// Functions
+// --------------------------------------------------------------------------------
+
+// function to read a whole shader source file into "source"
+bool readShaderFile(const std::string& file, std::string& source) {
+	std::ifstream stream(file, std::ios::in | std::ios::binary);
+	if (!stream.is_open())
+		return false;
+	source.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	return true;
+}
+
+// function to get the info log of a shader or program object
+std::string infoLog(GLuint id, bool isProgram) {
+	int infoLogLength = 0;
+	isProgram ? glGetProgramiv(id, GL_INFO_LOG_LENGTH, &infoLogLength) : glGetShaderiv(id, GL_INFO_LOG_LENGTH, &infoLogLength);
+	std::vector<char> errorMsg(infoLogLength + 1, '\0');
+	isProgram
+		? glGetProgramInfoLog(id, infoLogLength, NULL, errorMsg.data())
+		: glGetShaderInfoLog(id, infoLogLength, NULL, errorMsg.data());
+	return errorMsg.data();
+}
+
+// function to hash the shader sources together with the driver identification - a binary is only valid for the
+// exact sources on the exact driver that produced it (64-bit FNV-1a)
+uint64_t programCacheKey(const std::string& vShaderCode, const std::string& fShaderCode) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	auto add = [&](const char* data, size_t size) {
+		for (size_t i = 0; i < size; i++)
+			hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+		hash = (hash ^ 0xff) * 0x100000001b3ULL;
+	};
+	add(vShaderCode.data(), vShaderCode.size());
+	add(fShaderCode.data(), fShaderCode.size());
+	const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+	for (GLenum name : driverStrings) {
+		const char* value = (const char*)glGetString(name);
+		if (value != NULL)
+			add(value, strlen(value));
+	}
+	return hash;
+}
+
+// function to get the program binary cache file of "key"
+std::string programCachePath(uint64_t key) {
+	char name[64];
+	sprintf(name, "/program_%016llx.bin", (unsigned long long)key);
+	return std::string(CACHE_DIR) + name;
+}
+
+// function to create a program from the cached binary of "key", 0 when there is none or the driver rejects it
+GLuint loadProgramBinary(uint64_t key) {
+	FILE* file = fopen(programCachePath(key).c_str(), "rb");
+	if (file == NULL)
+		return 0;
+	programCacheHeader header;
+	std::vector<char> binary;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1
+		&& memcmp(header.magic, "PRGB", 4) == 0 && header.key == key && header.size < (1u << 30);
+	if (valid) {
+		binary.resize((size_t)header.size);
+		valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if (!valid)
+		return 0;
+
+	GLuint programID = glCreateProgram();
+	glProgramBinary(programID, header.format, binary.data(), (GLsizei)binary.size());
+	GLint status = GL_FALSE;
+	glGetProgramiv(programID, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		glDeleteProgram(programID);
+		return 0;
+	}
+	return programID;
+}
+
+// function to store the binary of a linked program under "key", written to a temporary file first
+void saveProgramBinary(GLuint programID, uint64_t key) {
+	GLint length = 0;
+	glGetProgramiv(programID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	programCacheHeader header;
+	memcpy(header.magic, "PRGB", 4);
+	header.key = key;
+	std::vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(programID, length, &length, &format, binary.data());
+	header.format = format;
+	header.size = (uint64_t)length;
+
+	makeCacheDir();
+	const std::string path = programCachePath(key);
+	const std::string tempPath = path + ".tmp";
+	FILE* out = fopen(tempPath.c_str(), "wb");
+	if (out == NULL)
+		return;
+	bool written = fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(binary.data(), 1, (size_t)length, out) == (size_t)length;
+	written = fclose(out) == 0 && written;
+
+	remove(path.c_str());
+	if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+		remove(tempPath.c_str());
+		std::cout << "Failed to write program cache - " << path << std::endl;
+	}
+}
+
+// function to insert preprocessor "defines" after the #version line of a shader source
+void insertDefines(std::string& source, const std::string& defines) {
+	const size_t version = source.find("#version");
+	const size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+	source.insert(lineEnd == std::string::npos ? 0 : lineEnd + 1, defines);
+}
+
+// function to read both shader files, on failure the reason is stored in "log"
+bool readShaderSources(std::string& vShaderCode, std::string& fShaderCode, std::string& log) {
+	if (!readShaderFile(VERTEX_SHADER_FILE, vShaderCode)) {
+		log = std::string("Failed to open vertex shader file - ") + VERTEX_SHADER_FILE;
+		return false;
+	}
+	if (!readShaderFile(FRAGMENT_SHADER_FILE, fShaderCode)) {
+		log = std::string("Failed to open fragment shader file - ") + FRAGMENT_SHADER_FILE;
+		return false;
+	}
+	return true;
+}
+
+// function to start building a program from the sources with "defines" - restored from the program binary
+// cache when the driver supports it and the sources and driver are unchanged, otherwise compiled and linked,
+// which returns at once when the driver compiles in parallel
+pendingProgram beginProgram(std::string vShaderCode, std::string fShaderCode, const std::string& defines) {
+	insertDefines(vShaderCode, defines);
+	insertDefines(fShaderCode, defines);
+
+	pendingProgram pending = { 0, 0, 0, false, 0 };
+	GLint binaryFormats = 0;
+	if (GLEW_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+	if (binaryFormats > 0) {
+		pending.cacheable = true;
+		pending.key = programCacheKey(vShaderCode, fShaderCode);
+		pending.program = loadProgramBinary(pending.key);
+		if (pending.program != 0)
+			return pending;
+	}
+
+	// compile vertex and fragment shader
+	const GLchar* vCode = vShaderCode.c_str();
+	const GLchar* fCode = fShaderCode.c_str();
+	pending.vShaderID = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(pending.vShaderID, 1, &vCode, NULL);
+	glCompileShader(pending.vShaderID);
+	pending.fShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(pending.fShaderID, 1, &fCode, NULL);
+	glCompileShader(pending.fShaderID);
+
+	// create program, attach shaders and link
+	pending.program = glCreateProgram();
+	glAttachShader(pending.program, pending.vShaderID);
+	glAttachShader(pending.program, pending.fShaderID);
+	if (pending.cacheable)
+		glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(pending.program);
+	return pending;
+}
+
+// function to check whether the driver has finished compiling and linking "pending" - always true without
+// parallel shader compile, where the status query waits instead
+bool programReady(const pendingProgram& pending) {
+	if (!useParallelShaderCompile)
+		return true;
+	GLint completed = GL_TRUE;
+	glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &completed);
+	return completed == GL_TRUE;
+}
+
+// function to finish "pending" - returns the linked program and adds it to the binary cache, or deletes it,
+// returns 0 and appends the compile or link log to "log"
+GLuint finishProgram(const pendingProgram& pending, std::string& log) {
+	// check link status, a failed link is explained by the compile logs first
+	GLint status = GL_FALSE;
+	glGetProgramiv(pending.program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		GLint vCompiled = GL_TRUE, fCompiled = GL_TRUE;
+		if (pending.vShaderID != 0) {
+			glGetShaderiv(pending.vShaderID, GL_COMPILE_STATUS, &vCompiled);
+			glGetShaderiv(pending.fShaderID, GL_COMPILE_STATUS, &fCompiled);
+		}
+		if (vCompiled == GL_FALSE)
+			log += std::string("Failed to compile vertex shader - ") + VERTEX_SHADER_FILE + "\n" + infoLog(pending.vShaderID, false) + "\n";
+		if (fCompiled == GL_FALSE)
+			log += std::string("Failed to compile fragment shader - ") + FRAGMENT_SHADER_FILE + "\n" + infoLog(pending.fShaderID, false) + "\n";
+		if (vCompiled == GL_TRUE && fCompiled == GL_TRUE)
+			log += "Failed to link program object.\n" + infoLog(pending.program, true) + "\n";
+	}
+
+	// the shader objects are no longer needed once the program is linked
+	if (pending.vShaderID != 0) {
+		glDetachShader(pending.program, pending.vShaderID);
+		glDetachShader(pending.program, pending.fShaderID);
+		glDeleteShader(pending.vShaderID);
+		glDeleteShader(pending.fShaderID);
+	}
+	if (status == GL_FALSE) {
+		glDeleteProgram(pending.program);
+		return 0;
+	}
+	if (pending.vShaderID != 0 && pending.cacheable)
+		saveProgramBinary(pending.program, pending.key);
+	return pending.program;
+}
+
+// function to check whether objects of class "obj" are drawn with a texture
+bool objectTextured(int obj) {
+	return obj == Object::OBJ_GROUND || obj == Object::OBJ_SKY || obj == Object::OBJ_TERRAIN;
+}
+
+// function to count the modes of object class "obj"
+int objectModes(int obj) {
+	return obj == Object::OBJ_TERRAIN ? OBJECT_MODES : 1;
+}
+
+// function to build the preprocessor header of a shader variant - the object class constants, then the selection
+std::string shaderDefines(int obj, bool fog, bool texture, int mode) {
+	std::string defines;
+	for (int i = Object::OBJ_GROUND; i < Object::OBJECTS; i++)
+		defines += "#define " + std::string(objectNames[i]) + " " + std::to_string(i) + "\n";
+	defines += "#define OBJ " + std::to_string(obj) + "\n";
+	defines += "#define USE_FOG " + std::to_string(fog ? 1 : 0) + "\n";
+	defines += "#define USE_TEXTURE " + std::to_string(texture ? 1 : 0) + "\n";
+	defines += "#define GROUND_LAYER " + std::to_string(obj == Object::OBJ_TERRAIN ? mode - 1 : -1) + "\n";
+	return defines;
+}
+
+// function to start building every distinct shader variant from the given sources into "pendingVariants"
+void beginShaderVariants(const std::string& vShaderCode, const std::string& fShaderCode) {
+	for (int obj = Object::OBJ_GROUND; obj < Object::OBJECTS; obj++)
+		for (int fog = 0; fog < 2; fog++)
+			for (int texture = 0; texture < 2; texture++)
+				if (texture == 0 || objectTextured(obj))
+					for (int mode = 0; mode < objectModes(obj); mode++)
+						pendingVariants[obj][fog][texture][mode] = beginProgram(vShaderCode, fShaderCode, shaderDefines(obj, fog == 1, texture == 1, mode));
+}
+
+// function to check whether every pending variant is compiled and linked
+bool shaderVariantsReady(void) {
+	for (int obj = Object::OBJ_GROUND; obj < Object::OBJECTS; obj++)
+		for (int fog = 0; fog < 2; fog++)
+			for (int texture = 0; texture < 2; texture++)
+				if (texture == 0 || objectTextured(obj))
+					for (int mode = 0; mode < objectModes(obj); mode++)
+						if (!programReady(pendingVariants[obj][fog][texture][mode]))
+							return false;
+	return true;
+}
+
+// function to finish the pending variants - when all of them link they replace "shaderVariants" and the previous
+// programs are deleted, otherwise the previous programs stay and the reason is appended to "log"
+bool finishShaderVariants(std::string& log) {
+	GLuint programs[OBJECTS][2][2][OBJECT_MODES] = {};
+	bool linked = true;
+	for (int obj = Object::OBJ_GROUND; obj < Object::OBJECTS; obj++) {
+		for (int fog = 0; fog < 2; fog++) {
+			for (int texture = 0; texture < 2; texture++) {
+				if (texture == 1 && !objectTextured(obj))
+					continue;
+				for (int mode = 0; mode < objectModes(obj); mode++) {
+					// one log is enough, the variants of a broken source fail alike
+					std::string variantLog;
+					programs[obj][fog][texture][mode] = finishProgram(pendingVariants[obj][fog][texture][mode], variantLog);
+					if (programs[obj][fog][texture][mode] == 0 && linked)
+						log += variantLog;
+					linked = linked && programs[obj][fog][texture][mode] != 0;
+				}
+			}
+		}
+	}
+
+	for (int obj = Object::OBJ_GROUND; obj < Object::OBJECTS; obj++) {
+		for (int fog = 0; fog < 2; fog++) {
+			for (int texture = 0; texture < 2; texture++) {
+				for (int mode = 0; mode < objectModes(obj); mode++) {
+					shaderVariant& variant = shaderVariants[obj][fog][texture][mode];
+					if (texture == 1 && !objectTextured(obj)) {
+						variant = shaderVariants[obj][fog][0][mode];
+						continue;
+					}
+					if (!linked) {
+						glDeleteProgram(programs[obj][fog][texture][mode]);
+						continue;
+					}
+					if (variant.program != 0)
+						glDeleteProgram(variant.program);
+					variant.program = programs[obj][fog][texture][mode];
+					variant.uniforms = reflectUniforms(variant.program);
+					bindUniformBlocks(variant.program);
+				}
+			}
+		}
+	}
+	return linked;
+}
+
+// function to drop the pending variants of a reload that was overtaken by a newer change - the objects are deleted
+// as they are, without waiting for the link or adding them to the binary cache
+void discardShaderVariants(void) {
+	for (int obj = Object::OBJ_GROUND; obj < Object::OBJECTS; obj++) {
+		for (int fog = 0; fog < 2; fog++) {
+			for (int texture = 0; texture < 2; texture++) {
+				if (texture == 1 && !objectTextured(obj))
+					continue;
+				for (int mode = 0; mode < objectModes(obj); mode++) {
+					// the shaders are flagged for deletion and go with the program they are attached to
+					const pendingProgram& pending = pendingVariants[obj][fog][texture][mode];
+					if (pending.vShaderID != 0) {
+						glDeleteShader(pending.vShaderID);
+						glDeleteShader(pending.fShaderID);
+					}
+					glDeleteProgram(pending.program);
+				}
+			}
+		}
+	}
+}
+
+// function to load every shader variant at startup, exits with the compile or link log on failure
+void initShaderVariants(void) {
+	// let the driver compile the variants on its own threads
+	useParallelShaderCompile = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+	std::string vShaderCode, fShaderCode, log;
+	if (!readShaderSources(vShaderCode, fShaderCode, log)) {
+		// output error message and exit
+		std::cout << log << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	beginShaderVariants(vShaderCode, fShaderCode);
+	if (!finishShaderVariants(log)) {
+		std::cout << log << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+// function to set the texture units of every variant - water and sky each sample their own unit
+void setConstantUniforms(void) {
+	forEachVariant([&]() {
+		setUniform(uniforms.ourTexture, object == Object::OBJ_SKY ? Texture::TEX_SKY : Texture::TEX_WATER);
+		setUniform(uniforms.groundTextures, GROUND_TEXTURE_UNIT);
+		setUniform(uniforms.splatMap, SPLAT_TEXTURE_UNIT);
+		setUniform(uniforms.impostorAtlas, IMPOSTOR_TEXTURE_UNIT);
+	});
+}
+
+// function to attach the uniform blocks of a program to their binding points
+void bindUniformBlocks(GLuint programID) {
+	const GLuint frameBlock = glGetUniformBlockIndex(programID, "FrameUniforms");
+	if (frameBlock != GL_INVALID_INDEX)
+		glUniformBlockBinding(programID, frameBlock, FRAME_UNIFORM_BINDING);
+	const GLuint objectBlock = glGetUniformBlockIndex(programID, "ObjectUniforms");
+	if (objectBlock != GL_INVALID_INDEX)
+		glUniformBlockBinding(programID, objectBlock, OBJECT_UNIFORM_BINDING);
+}
+
+// function to create "uniformRing"
+void initUniformRing(void) {
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformRingAlignment);
+	glGenBuffers(1, &uniformRing);
+	glBindBuffer(GL_UNIFORM_BUFFER, uniformRing);
+	const GLsizeiptr size = UNIFORM_RING_REGION_SIZE * UNIFORM_RING_REGIONS;
+	if (GLEW_ARB_buffer_storage) {
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, size, NULL, flags);
+		uniformRingMapping = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+	}
+	else
+		glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+	for (int i = 0; i < UNIFORM_RING_REGIONS; i++)
+		uniformRingFences[i] = 0;
+}
+
+// function to fence the current region of "uniformRing" and move on to the next one, waiting until the GPU is
+// done with it - once per frame, or earlier when a frame fills a whole region
+void nextUniformRegion(void) {
+	uniformRingFences[uniformRingRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	uniformRingRegion = (uniformRingRegion + 1) % UNIFORM_RING_REGIONS;
+	uniformRingOffset = 0;
+
+	GLsync& fence = uniformRingFences[uniformRingRegion];
+	if (fence == 0)
+		return;
+	while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+		continue;
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+// function to copy a uniform block into the current region of "uniformRing" and bind it to "binding"
+void writeUniformBlock(GLuint binding, const void* data, GLsizeiptr size) {
+	GLintptr offset = (uniformRingOffset + uniformRingAlignment - 1) / uniformRingAlignment * uniformRingAlignment;
+	if (offset + size > UNIFORM_RING_REGION_SIZE) {
+		nextUniformRegion();
+		offset = 0;
+	}
+	const GLintptr position = uniformRingRegion * UNIFORM_RING_REGION_SIZE + offset;
+	if (uniformRingMapping != NULL)
+		memcpy(uniformRingMapping + position, data, size);
+	else {
+		// the fences already keep the GPU out of this range, so the driver need not synchronize
+		glBindBuffer(GL_UNIFORM_BUFFER, uniformRing);
+		void* target = glMapBufferRange(GL_UNIFORM_BUFFER, position, size,
+			GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		if (target != NULL) {
+			memcpy(target, data, size);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+		}
+	}
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, uniformRing, position, size);
+	uniformRingOffset = offset + size;
+}
+
+// function to write the per-frame uniform block - camera, light, fog range and splat map mapping
+void setFrameUniforms(void) {
+	// world X Z to splat map texture coordinate - texel centers sit on the sampled height samples
+	const float halfSize = (worldSize - 1) / 2.0f;
+	frameUniforms frame;
+	frame.view = view;
+	frame.proj = proj;
+	frame.viewPos = glm::vec4(camX, camY, camZ, 1.0f);
+	frame.sunlightPos = glm::vec4(sunlightPos + glm::vec3(camX, 0.0f, camZ - WORLD_SIZE / 2.0f), 1.0f);
+	frame.sunlightColor = glm::vec4(sunlightColor, 1.0f);
+	frame.eyePos = glm::vec4(eyePosition(), 1.0f);
+	frame.fogSplat = glm::vec4(WORLD_SIZE / 5.0f, WORLD_SIZE / 1.5f,
+		1.0f / (splatStep * splatSize), (halfSize / splatStep + 0.5f) / splatSize);
+	writeUniformBlock(FRAME_UNIFORM_BINDING, &frame, sizeof(frame));
+}
+
+// function to write the uniform block of the next draw
+void setObjectUniforms(const glm::mat4& modelMatrix, const glm::vec3& color, const glm::vec4& params) {
+	objectUniforms block;
+	block.model = modelMatrix;
+	block.color = glm::vec4(color, 1.0f);
+	block.params = params;
+	writeUniformBlock(OBJECT_UNIFORM_BINDING, &block, sizeof(block));
+}
+
+// function to start watching the shader files
+void initShaderWatch(void) {
+#if defined(__linux__)
+	// written in place (IN_CLOSE_WRITE) or replaced by the editor (IN_MOVED_TO)
+	shaderWatch = inotify_init1(IN_NONBLOCK);
+	if (shaderWatch >= 0 && inotify_add_watch(shaderWatch, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(shaderWatch);
+		shaderWatch = -1;
+	}
+#endif
+	const char* files[2] = { VERTEX_SHADER_FILE, FRAGMENT_SHADER_FILE };
+	for (int i = 0; i < 2; i++) {
+		struct stat info;
+		shaderFileTimes[i] = stat(files[i], &info) == 0 ? info.st_mtime : 0;
+	}
+	lastShaderPoll = std::chrono::steady_clock::now();
+}
+
+// function to check whether a shader file has been written since the last call
+bool shaderFilesChanged(void) {
+#if defined(__linux__)
+	if (shaderWatch >= 0) {
+		bool changed = false;
+		alignas(struct inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(shaderWatch, buffer, sizeof(buffer))) > 0) {
+			for (char* next = buffer; next < buffer + length; ) {
+				const struct inotify_event* event = (const struct inotify_event*)next;
+				if (event->len > 0 && (strcmp(event->name, VERTEX_SHADER_FILE) == 0 || strcmp(event->name, FRAGMENT_SHADER_FILE) == 0))
+					changed = true;
+				next += sizeof(struct inotify_event) + event->len;
+			}
+		}
+		return changed;
+	}
+#endif
+	const auto now = std::chrono::steady_clock::now();
+	if (now - lastShaderPoll < std::chrono::milliseconds(SHADER_POLL_INTERVAL))
+		return false;
+	lastShaderPoll = now;
+
+	bool changed = false;
+	const char* files[2] = { VERTEX_SHADER_FILE, FRAGMENT_SHADER_FILE };
+	for (int i = 0; i < 2; i++) {
+		struct stat info;
+		if (stat(files[i], &info) == 0 && info.st_mtime != shaderFileTimes[i]) {
+			shaderFileTimes[i] = info.st_mtime;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// function to rebuild the shader variants when their files change and swap them in once they have all linked,
+// called every frame - a broken shader keeps the running programs and its log is printed
+void pollShaderReload(void) {
+	if (shaderFilesChanged()) {
+		std::string vShaderCode, fShaderCode, log;
+		if (readShaderSources(vShaderCode, fShaderCode, log)) {
+			if (shaderReloadPending)
+				discardShaderVariants();
+			beginShaderVariants(vShaderCode, fShaderCode);
+			shaderReloadPending = true;
+		}
+		else
+			std::cout << log << std::endl;
+	}
+
+	if (!shaderReloadPending || !shaderVariantsReady())
+		return;
+	shaderReloadPending = false;
+	std::string log;
+	if (finishShaderVariants(log)) {
+		setConstantUniforms();
+		if (treeLodCount == TREE_LODS)
+			bakeImpostors();
+		std::cout << "Shaders reloaded" << std::endl;
+	}
+	else
+		std::cout << "Shader reload failed, keeping the previous shaders" << std::endl << log;
+}
+
+// function to switch to the program of object class "obj" in "mode" for the current fog and texture settings
+void useObjectProgram(int obj, int mode) {
+	const shaderVariant& variant = shaderVariants[obj][useFog ? 1 : 0][useTexture ? 1 : 0][mode];
+	object = obj;
+	program = variant.program;
+	uniforms = variant.uniforms;
+	glUseProgram(program);
+}
+
+// function to run "body" with each distinct variant bound
+void forEachVariant(const std::function<void(void)>& body) {
+	for (int obj = Object::OBJ_GROUND; obj < Object::OBJECTS; obj++) {
+		for (int fog = 0; fog < 2; fog++) {
+			for (int texture = 0; texture < 2; texture++) {
+				if (texture == 1 && !objectTextured(obj))
+					continue;
+				for (int mode = 0; mode < objectModes(obj); mode++) {
+					const shaderVariant& variant = shaderVariants[obj][fog][texture][mode];
+					object = obj;
+					program = variant.program;
+					uniforms = variant.uniforms;
+					glUseProgram(program);
+					body();
+				}
+			}
+		}
+	}
+}
+
+// function to look up an active uniform of the expected type, -1 if it is not used by the program
+template <typename T>
+Uniform<T> findUniform(const std::map<std::string, std::pair<GLint, GLenum>>& active, const char* name, GLenum type) {
+	Uniform<T> uniform;
+	auto it = active.find(name);
+	if (it == active.end())
+		return uniform;
+
+	if (it->second.second != type) {
+		std::cout << "Uniform \"" << name << "\" has unexpected type 0x" << std::hex << it->second.second << std::dec << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	uniform.location = it->second.first;
+	return uniform;
+}
+
+// function to build the uniform table of a linked program
+ProgramUniforms reflectUniforms(GLuint programID) {
+	// collect name, location and type of every active uniform
+	std::map<std::string, std::pair<GLint, GLenum>> active;
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<GLchar> name(maxLength + 1);
+
+	for (GLint i = 0; i < count; i++) {
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(programID, i, (GLsizei)name.size(), NULL, &size, &type, name.data());
+		active[name.data()] = std::make_pair(glGetUniformLocation(programID, name.data()), type);
+	}
+
+	ProgramUniforms table;
+	table.ourTexture = findUniform<int>(active, "ourTexture", GL_SAMPLER_2D);
+	table.groundTextures = findUniform<int>(active, "groundTextures", GL_SAMPLER_2D_ARRAY);
+	table.splatMap = findUniform<int>(active, "splatMap", GL_SAMPLER_2D);
+	table.impostorAtlas = findUniform<int>(active, "impostorAtlas", GL_SAMPLER_2D_ARRAY);
+	return table;
+}
+
+// function to set a sampler of the current program to a texture unit through its typed handle
+void setUniform(Uniform<int> uniform, int value) { glUniform1i(uniform.location, value); }
+
+// function to create every texture with its placeholder texel and start decoding the images on worker threads
+void startTextureLoading(void) {
+	useCompressedTextures = GLEW_EXT_texture_compression_s3tc;
+	for (int i = 0; i < TEXTURES; i++) {
+		textureImages[i].ready = false;
+		textureImages[i].uploaded = false;
+		if (isGroundTexture(i))
+			continue;
+		// generate 1 texture with ID of "textureID"
+		glGenTextures(1, &textureID[i]);
+		// activate the texture unit first before binding texture
+		glActiveTexture(GL_TEXTURE0 + i);
+		// bind textureID before use
+		glBindTexture(GL_TEXTURE_2D, textureID[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, texturePlaceholders[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	// ground array - every mip level of every layer starts filled with the placeholder color of the layer,
+	// as a constant BC1 block when compressed
+	glGenTextures(1, &groundArrayTexture);
+	glActiveTexture(GL_TEXTURE0 + GROUND_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, groundArrayTexture);
+	const int levels = mipLevels(GROUND_LAYER_SIZE, GROUND_LAYER_SIZE);
+	std::vector<unsigned char> fill;
+	for (int mip = 0; mip < levels; mip++) {
+		const int size = glm::max(GROUND_LAYER_SIZE >> mip, 1);
+		const size_t layerBytes = useCompressedTextures ? (size_t)((size + 3) / 4) * ((size + 3) / 4) * 8 : (size_t)size * size * 3;
+		fill.resize(layerBytes * GROUND_LAYERS);
+		for (int layer = 0; layer < GROUND_LAYERS; layer++) {
+			const unsigned char* color = texturePlaceholders[Texture::TEX_GRASS + layer];
+			unsigned char pattern[16 * 3];
+			if (useCompressedTextures) {
+				unsigned char pixels[16 * 3];
+				for (int i = 0; i < 16; i++)
+					memcpy(&pixels[i * 3], color, 3);
+				encodeBC1Block(pixels, pattern);
+			}
+			const size_t patternSize = useCompressedTextures ? 8 : 3;
+			for (size_t offset = 0; offset < layerBytes; offset += patternSize)
+				memcpy(&fill[layer * layerBytes + offset], useCompressedTextures ? pattern : color, patternSize);
+		}
+		if (useCompressedTextures)
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, mip, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, size, size, GROUND_LAYERS, 0, (GLsizei)fill.size(), fill.data());
+		else
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, mip, GL_RGB, size, size, GROUND_LAYERS, 0, GL_RGB, GL_UNSIGNED_BYTE, fill.data());
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	for (int i = Texture::TEX_GRASS; i <= Texture::TEX_EARTH; i++)
+		textureID[i] = groundArrayTexture;
+
+	// a small pool of workers takes the textures in order, the slowest image bounds the loading time
+	nextTextureJob = 0;
+	const int workers = glm::clamp((int)std::thread::hardware_concurrency(), 1, (int)TEXTURES);
+	for (int i = 0; i < workers; i++) {
+		textureWorkers.push_back(std::thread([]() {
+			for (int job = nextTextureJob++; job < TEXTURES; job = nextTextureJob++)
+				decodeTexture(job);
+		}));
+	}
+	atexit(joinTextureWorkers);
+}
+
+// function to check whether texture "index" is a layer of the ground array
+bool isGroundTexture(int index) {
+	return index >= Texture::TEX_GRASS && index <= Texture::TEX_EARTH;
+}
+
+// function to get the number of mip levels of a full chain down to 1x1
+int mipLevels(int width, int height) {
+	int levels = 1;
+	while ((width >> (levels - 1)) > 1 || (height >> (levels - 1)) > 1)
+		levels++;
+	return levels;
+}
+
+// function to decode an image to RGB, resampled bilinearly to size x size unless size is 0 - empty on failure
+std::vector<unsigned char> loadImage(const char* file, int size, int& width, int& height) {
+	int nrChannels;
+	unsigned char* data = stbi_load(file, &width, &height, &nrChannels, 3);
+	if (!data)
+		return std::vector<unsigned char>();
+	std::vector<unsigned char> image(data, data + (size_t)width * height * 3);
+	stbi_image_free(data);
+	if (size == 0 || (width == size && height == size))
+		return image;
+
+	std::vector<unsigned char> resized((size_t)size * size * 3);
+	for (int y = 0; y < size; y++) {
+		const float sourceY = glm::clamp((y + 0.5f) * height / size - 0.5f, 0.0f, height - 1.0f);
+		const int y0 = (int)sourceY, y1 = glm::min(y0 + 1, height - 1);
+		for (int x = 0; x < size; x++) {
+			const float sourceX = glm::clamp((x + 0.5f) * width / size - 0.5f, 0.0f, width - 1.0f);
+			const int x0 = (int)sourceX, x1 = glm::min(x0 + 1, width - 1);
+			for (int c = 0; c < 3; c++) {
+				const float top = glm::mix((float)image[((size_t)y0 * width + x0) * 3 + c], (float)image[((size_t)y0 * width + x1) * 3 + c], sourceX - x0);
+				const float bottom = glm::mix((float)image[((size_t)y1 * width + x0) * 3 + c], (float)image[((size_t)y1 * width + x1) * 3 + c], sourceX - x0);
+				resized[((size_t)y * size + x) * 3 + c] = (unsigned char)(glm::mix(top, bottom, sourceY - y0) + 0.5f);
+			}
+		}
+	}
+	width = size;
+	height = size;
+	return resized;
+}
+
+// function to get the next mip level of an RGB image - 2x2 box filter, odd sizes reuse the last row or column
+std::vector<unsigned char> halveImage(const std::vector<unsigned char>& level, int width, int height) {
+	const int nextWidth = glm::max(width / 2, 1);
+	const int nextHeight = glm::max(height / 2, 1);
+	std::vector<unsigned char> next((size_t)nextWidth * nextHeight * 3);
+	for (int y = 0; y < nextHeight; y++) {
+		for (int x = 0; x < nextWidth; x++) {
+			const int x0 = glm::min(x * 2, width - 1), x1 = glm::min(x * 2 + 1, width - 1);
+			const int y0 = glm::min(y * 2, height - 1), y1 = glm::min(y * 2 + 1, height - 1);
+			for (int c = 0; c < 3; c++) {
+				const int sum = level[((size_t)y0 * width + x0) * 3 + c] + level[((size_t)y0 * width + x1) * 3 + c]
+					+ level[((size_t)y1 * width + x0) * 3 + c] + level[((size_t)y1 * width + x1) * 3 + c];
+				next[((size_t)y * nextWidth + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+	return next;
+}
+
+// function to load texture "index" into "textureImages" on a worker thread - no GL calls
+// block-compressed when the driver supports BC1 (transcoded on first use), RGB otherwise, both with all mip levels
+void decodeTexture(int index) {
+	textureImage& image = textureImages[index];
+	const char* file = textureFiles[index];
+	const int size = isGroundTexture(index) ? GROUND_LAYER_SIZE : 0;
+	auto sizeMatches = [&]() { return size == 0 || (image.width == size && image.height == size); };
+
+	if (useCompressedTextures
+		&& ((textureCacheValid(file) && readCompressedTexture(file, image) && sizeMatches())
+			|| (transcodeTexture(file, size) && readCompressedTexture(file, image)))) {
+		image.ready = true;
+		return;
+	}
+
+	int width, height;
+	std::vector<unsigned char> level = loadImage(file, size, width, height);
+	image.compressed = false;
+	image.width = level.empty() ? 0 : width;
+	image.height = height;
+	image.levels = mipLevels(width, height);
+	image.data.clear();
+	image.levelOffset.clear();
+	for (int mip = 0; mip < image.levels && !level.empty(); mip++) {
+		image.levelOffset.push_back(image.data.size());
+		image.data.insert(image.data.end(), level.begin(), level.end());
+		level = halveImage(level, glm::max(width >> mip, 1), glm::max(height >> mip, 1));
+	}
+	image.ready = true;
+}
+
+// function to upload a decoded texture through a pixel buffer object, replacing its placeholder
+void uploadTexture(int index) {
+	textureImage& image = textureImages[index];
+	image.uploaded = true;
+	if (image.width == 0) {
+		std::cout << "Failed to load texture" << std::endl;
+		return;
+	}
+
+	// copy the image into a mapped pixel buffer, the texture uploads then source from the buffer
+	GLuint PBO;
+	glGenBuffers(1, &PBO);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, PBO);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, image.data.size(), NULL, GL_STREAM_DRAW);
+	void* pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, image.data.size(), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (pixels != NULL) {
+		memcpy(pixels, image.data.data(), image.data.size());
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	else {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	// ground layers replace their slice of the array, other textures get their own storage
+	const bool ground = isGroundTexture(index);
+	const int layer = index - Texture::TEX_GRASS;
+	glActiveTexture(GL_TEXTURE0 + (ground ? GROUND_TEXTURE_UNIT : index));
+	glBindTexture(ground ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, textureID[index]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int mip = 0; mip < image.levels; mip++) {
+		const GLsizei width = glm::max(image.width >> mip, 1);
+		const GLsizei height = glm::max(image.height >> mip, 1);
+		const GLsizei size = (GLsizei)((mip + 1 < image.levels ? image.levelOffset[mip + 1] : image.data.size()) - image.levelOffset[mip]);
+		// with a pixel buffer bound the data pointer is an offset into the buffer, without one it is client memory
+		const void* source = pixels != NULL
+			? (const void*)image.levelOffset[mip]
+			: (const void*)(image.data.data() + image.levelOffset[mip]);
+		if (ground && image.compressed)
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip, 0, 0, layer, width, height, 1, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, size, source);
+		else if (ground)
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip, 0, 0, layer, width, height, 1, GL_RGB, GL_UNSIGNED_BYTE, source);
+		else if (image.compressed)
+			glCompressedTexImage2D(GL_TEXTURE_2D, mip, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, width, height, 0, size, source);
+		else
+			glTexImage2D(GL_TEXTURE_2D, mip, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, source);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(1, &PBO);
+
+	if (!ground) {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels - 1);
+		// set texture behaviour
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	// the CPU copy is no longer needed
+	std::vector<unsigned char>().swap(image.data);
+}
+
+// function to upload the textures that finished decoding since the last call, true once all are uploaded
+bool pollTextures(void) {
+	if (textureWorkers.empty())
+		return true;
+
+	bool done = true;
+	for (int i = 0; i < TEXTURES; i++) {
+		if (!textureImages[i].uploaded && textureImages[i].ready)
+			uploadTexture(i);
+		done = done && textureImages[i].uploaded;
+	}
+	if (done)
+		joinTextureWorkers();
+	return done;
+}
+
+// function to wait for the texture workers, also run at exit so no worker outlives the textures
+void joinTextureWorkers(void) {
+	for (std::thread& worker : textureWorkers)
+		worker.join();
+	textureWorkers.clear();
+}
+
+// function to create CACHE_DIR if it does not exist yet
+void makeCacheDir(void) {
+#if defined(_WIN32)
+	_mkdir(CACHE_DIR);
+#else
+	mkdir(CACHE_DIR, 0755);
+#endif
+}
+
+// function to get the KTX file name of a texture - "textures/grass.jpg" is cached as "cache/grass.ktx"
+std::string textureCachePath(const char* file) {
+	std::string name = file;
+	const size_t slash = name.find_last_of("/\\");
+	if (slash != std::string::npos)
+		name = name.substr(slash + 1);
+	const size_t dot = name.find_last_of('.');
+	if (dot != std::string::npos)
+		name = name.substr(0, dot);
+	return std::string(CACHE_DIR) + "/" + name + ".ktx";
+}
+
+// function to check that the cached KTX of a texture exists and is not older than the source image
+bool textureCacheValid(const char* file) {
+	struct stat source, cached;
+	if (stat(textureCachePath(file).c_str(), &cached) != 0)
+		return false;
+	return stat(file, &source) != 0 || cached.st_mtime >= source.st_mtime;
+}
+
+// function to encode a 4x4 block of RGB pixels to BC1 (DXT1) - 2 RGB565 endpoints and 2-bit indices
+// endpoints are the extremes of the pixels along their principal axis, the block always uses 4-color mode
+void encodeBC1Block(const unsigned char* pixels, unsigned char* block) {
+	glm::vec3 color[16];
+	glm::vec3 mean = glm::vec3(0.0f);
+	for (int i = 0; i < 16; i++) {
+		color[i] = glm::vec3(pixels[i * 3], pixels[i * 3 + 1], pixels[i * 3 + 2]);
+		mean += color[i] / 16.0f;
+	}
+
+	// principal axis of the color covariance by power iteration
+	glm::mat3 covariance = glm::mat3(0.0f);
+	for (int i = 0; i < 16; i++)
+		covariance += glm::outerProduct(color[i] - mean, color[i] - mean);
+	glm::vec3 axis = glm::vec3(0.577f, 0.577f, 0.577f);
+	for (int i = 0; i < 8; i++) {
+		const glm::vec3 next = covariance * axis;
+		const float length = glm::length(next);
+		if (length < 1e-6f)
+			break;
+		axis = next / length;
+	}
+
+	float minProjection = 1e30f, maxProjection = -1e30f;
+	for (int i = 0; i < 16; i++) {
+		const float projection = glm::dot(color[i] - mean, axis);
+		minProjection = glm::min(minProjection, projection);
+		maxProjection = glm::max(maxProjection, projection);
+	}
+
+	// quantize the endpoints to RGB565, endpoint 0 must be the larger one for 4-color mode
+	auto toRGB565 = [](glm::vec3 c) {
+		c = glm::clamp(c, 0.0f, 255.0f);
+		return (uint16_t)(((int)(c.r * 31.0f / 255.0f + 0.5f) << 11) | ((int)(c.g * 63.0f / 255.0f + 0.5f) << 5) | (int)(c.b * 31.0f / 255.0f + 0.5f));
+	};
+	auto fromRGB565 = [](uint16_t c) {
+		return glm::vec3(((c >> 11) & 31) * 255.0f / 31.0f, ((c >> 5) & 63) * 255.0f / 63.0f, (c & 31) * 255.0f / 31.0f);
+	};
+	uint16_t color0 = toRGB565(mean + axis * maxProjection);
+	uint16_t color1 = toRGB565(mean + axis * minProjection);
+	if (color0 < color1)
+		std::swap(color0, color1);
+
+	// palette order of the 2-bit indices: endpoint 0, endpoint 1, 2/3 + 1/3, 1/3 + 2/3
+	glm::vec3 palette[4];
+	palette[0] = fromRGB565(color0);
+	palette[1] = fromRGB565(color1);
+	palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+	palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+
+	uint32_t indices = 0;
+	if (color0 != color1) {
+		for (int i = 0; i < 16; i++) {
+			int best = 0;
+			float bestDistance = 1e30f;
+			for (int p = 0; p < 4; p++) {
+				const glm::vec3 difference = color[i] - palette[p];
+				const float distance = glm::dot(difference, difference);
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= (uint32_t)best << (i * 2);
+		}
+	}
+
+	// little-endian endpoints followed by the indices, pixel 0 in the lowest bits
+	block[0] = color0 & 0xFF;
+	block[1] = color0 >> 8;
+	block[2] = color1 & 0xFF;
+	block[3] = color1 >> 8;
+	for (int i = 0; i < 4; i++)
+		block[4 + i] = (indices >> (i * 8)) & 0xFF;
+}
+
+// function to decode a texture image (resampled to size x size unless size is 0), build its mip chain,
+// compress every level to BC1 and write it as KTX
+bool transcodeTexture(const char* file, int size) {
+	int width, height;
+	std::vector<unsigned char> level = loadImage(file, size, width, height);
+	if (level.empty())
+		return false;
+	const int levels = mipLevels(width, height);
+
+	ktxHeader header = {};
+	memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+	header.endianness = 0x04030201;
+	header.glTypeSize = 1;
+	header.glInternalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	header.glBaseInternalFormat = GL_RGB;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.numberOfFaces = 1;
+	header.numberOfMipmapLevels = levels;
+
+	makeCacheDir();
+	const std::string path = textureCachePath(file);
+	const std::string tempPath = path + ".tmp";
+	FILE* out = fopen(tempPath.c_str(), "wb");
+	if (out == NULL)
+		return false;
+	bool written = fwrite(&header, sizeof(header), 1, out) == 1;
+
+	std::vector<unsigned char> blocks;
+	for (int mip = 0; mip < levels && written; mip++) {
+		// compress rows of blocks in parallel - blocks past the right or bottom edge repeat the last row and column
+		const int blocksX = (width + 3) / 4;
+		const int blocksY = (height + 3) / 4;
+		blocks.resize((size_t)blocksX * blocksY * 8);
+		parallelFor(0, blocksY, [&](int firstRow, int lastRow) {
+			for (int by = firstRow; by < lastRow; by++) {
+				for (int bx = 0; bx < blocksX; bx++) {
+					unsigned char pixels[16 * 3];
+					for (int y = 0; y < 4; y++) {
+						for (int x = 0; x < 4; x++) {
+							const size_t source = ((size_t)glm::min(by * 4 + y, height - 1) * width + glm::min(bx * 4 + x, width - 1)) * 3;
+							memcpy(&pixels[(y * 4 + x) * 3], &level[source], 3);
+						}
+					}
+					encodeBC1Block(pixels, &blocks[((size_t)by * blocksX + bx) * 8]);
+				}
+			}
+		});
+		const uint32_t imageSize = (uint32_t)blocks.size();
+		written = fwrite(&imageSize, sizeof(imageSize), 1, out) == 1
+			&& fwrite(blocks.data(), 1, blocks.size(), out) == blocks.size();
+
+		level = halveImage(level, width, height);
+		width = glm::max(width / 2, 1);
+		height = glm::max(height / 2, 1);
+	}
+	written = fclose(out) == 0 && written;
+
+	remove(path.c_str());
+	if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+		remove(tempPath.c_str());
+		std::cout << "Failed to write texture cache - " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// function to read the cached BC1 KTX of a texture and all its mip levels into "image"
+bool readCompressedTexture(const char* file, textureImage& image) {
+	std::ifstream stream(textureCachePath(file), std::ios::in | std::ios::binary);
+	ktxHeader header;
+	if (!stream.read((char*)&header, sizeof(header))
+		|| memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0
+		|| header.endianness != 0x04030201
+		|| header.glInternalFormat != GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+		|| header.numberOfMipmapLevels == 0)
+		return false;
+	stream.seekg(header.bytesOfKeyValueData, std::ios::cur);
+
+	image.compressed = true;
+	image.width = header.pixelWidth;
+	image.height = header.pixelHeight;
+	image.levels = header.numberOfMipmapLevels;
+	image.data.clear();
+	image.levelOffset.clear();
+	for (int mip = 0; mip < image.levels; mip++) {
+		const int width = glm::max(image.width >> mip, 1);
+		const int height = glm::max(image.height >> mip, 1);
+		uint32_t imageSize;
+		if (!stream.read((char*)&imageSize, sizeof(imageSize)) || imageSize != (uint32_t)((width + 3) / 4) * ((height + 3) / 4) * 8)
+			return false;
+		image.levelOffset.push_back(image.data.size());
+		image.data.resize(image.data.size() + imageSize);
+		if (!stream.read((char*)&image.data[image.levelOffset[mip]], imageSize))
+			return false;
+	}
+	return true;
+}
+
+// function to generate a random value between [-d, +d]
+float randomize(double d) {
+	float randVal = ((float)rand()) / (float)RAND_MAX;
+	return (randVal * 2 * (float)d) - (float)d;
+}
+
+// function to access height sample X Z of "heightField" while it is generated
+float& heightAt(int x, int z) {
+	return heightField[(size_t)x * worldSize + z];
+}
+
+// function to read height sample X Z of "terrainHeights"
+float heightSample(int x, int z) {
+	return terrainHeights[(size_t)x * worldSize + z];
+}
+
+// function to get a random value between [-d, +d] for height sample X Z of a midpoint displacement level
+// counter-based - the value depends only on its arguments, so samples can be generated in any order
+float cellRandom(unsigned int seed, int level, int x, int z, double d) {
+	// splitmix64 finalizer over the packed cell coordinates
+	unsigned long long h = seed * 0x9E3779B97F4A7C15ull;
+	h ^= ((unsigned long long)level << 58) ^ ((unsigned long long)(unsigned int)x << 29) ^ (unsigned long long)(unsigned int)z;
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+	h ^= h >> 31;
+	const float randVal = (float)(h >> 40) / (float)(1 << 24);
+	return (randVal * 2 * (float)d) - (float)d;
+}
+
+// function to run body(first, last) over [begin, end) split into one band per hardware thread
+void parallelFor(int begin, int end, const std::function<void(int, int)>& body) {
+	const int count = end - begin;
+	if (count <= 0)
+		return;
+	const int threads = glm::clamp((int)std::thread::hardware_concurrency(), 1, count);
+	const int band = (count + threads - 1) / threads;
+	std::vector<std::thread> workers;
+	for (int first = begin + band; first < end; first += band)
+		workers.push_back(std::thread(body, first, glm::min(first + band, end)));
+	body(begin, glm::min(begin + band, end));
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+// function to generate terrain data and store in "heightField" and "vertexNormal"
+// the same seed gives a bit-identical terrain for any number of threads
+void generateTerrain(float UL, float LL, float LR, float UR, unsigned int seed) {
+	const int n = worldSize;
+	double d = MAX_HEIGHT;
+	chunksPerDimension = (worldSize - 1) / CHUNK_QUADS;
+	heightField.assign((size_t)worldSize * worldSize, 0.0f);
+	terrainHeights = heightField.data();
+	vertexNormal.assign((size_t)worldSize * worldSize, glm::vec3(0.0f, 1.0f, 0.0f));
+
+	// initial height at the 4 corners of the terrain
+	const int first = 0;
+	const int last = worldSize - 1;
+	heightAt(first, first) = UL;
+	heightAt(first, last) = LL;
+	heightAt(last, last) = LR;
+	heightAt(last, first) = UR;
+
+	// calculate height of ground - using midpoint displacement algorithm
+	// every level writes each sample once: the square step fills the square centers, then the diamond step
+	// fills the edge midpoints from the two edge corners and the center of the square after the edge
+	for (int i = worldSize - 1, level = 0; i > 1; i /= 2, level++) {
+		const int half = i / 2;
+
+		// square step - one row of squares per index
+		parallelFor(0, (n - 1) / i, [&](int firstRow, int lastRow) {
+			for (int x = firstRow * i; x < lastRow * i; x += i) {
+				for (int z = 0; z < n - 1; z += i) {
+					const float x0z0 = heightAt(x, z);
+					const float xiz0 = heightAt(x + i, z);
+					const float x0zi = heightAt(x, z + i);
+					const float xizi = heightAt(x + i, z + i);
+					heightAt(x + half, z + half) = (x0z0 + x0zi + xizi + xiz0) / 4 + cellRandom(seed, level, x + half, z + half, d);
+				}
+			}
+		});
+
+		// diamond steps - one row of edge midpoints per index, the last row and column use the square before them
+		parallelFor(0, (n - 1) / half + 1, [&](int firstRow, int lastRow) {
+			for (int x = firstRow * half; x < lastRow * half; x += half) {
+				if (x % i == 0) {
+					const int midX = x < n - 1 ? x + half : x - half;
+					for (int z = half; z < n - 1; z += i)
+						heightAt(x, z) = (heightAt(x, z - half) + heightAt(x, z + half) + heightAt(midX, z)) / 3 + cellRandom(seed, level, x, z, d);
+				}
+				else {
+					for (int z = 0; z < n; z += i) {
+						const int midZ = z < n - 1 ? z + half : z - half;
+						heightAt(x, z) = (heightAt(x - half, z) + heightAt(x + half, z) + heightAt(x, midZ)) / 3 + cellRandom(seed, level, x, z, d);
+					}
+				}
+			}
+		});
+
+		d *= glm::pow(2, -ROUGHNESS);
+	}
+
+	// calculate normal vector for each vertex of terrain
+	computeNormals();
+}
+
+// function to calculate "vertexNormal" for rows [firstRow, lastRow) from central differences of "heightField"
+// the normal of height field y = h(x, z) is normalize(-dh/dx, 1, -dh/dz), border samples use one-sided differences
+void computeNormalRows(int firstRow, int lastRow) {
+	const int n = worldSize;
+	for (int x = firstRow; x < lastRow; x++) {
+		const float* row = &heightField[(size_t)x * n];
+		const float* prevRow = &heightField[(size_t)glm::max(x - 1, 0) * n];
+		const float* nextRow = &heightField[(size_t)glm::min(x + 1, n - 1) * n];
+		const float scaleX = 1.0f / (glm::min(x + 1, n - 1) - glm::max(x - 1, 0));
+		glm::vec3* normal = &vertexNormal[(size_t)x * n];
+
+		// one sample, clamped neighbours
+		auto scalarNormal = [&](int z) {
+			const int zM = glm::max(z - 1, 0);
+			const int zP = glm::min(z + 1, n - 1);
+			const float dx = (nextRow[z] - prevRow[z]) * scaleX;
+			const float dz = (row[zP] - row[zM]) / (zP - zM);
+			const float inv = 1.0f / sqrt(dx * dx + 1.0f + dz * dz);
+			normal[z] = glm::vec3(-dx * inv, inv, -dz * inv);
+		};
+
+		// interior samples of the row in SIMD lanes, the first and last sample and the remainder in scalar code
+		scalarNormal(0);
+		int z = 1;
+#if defined(TERRAIN_SIMD_WIDTH)
+		float nx[TERRAIN_SIMD_WIDTH], ny[TERRAIN_SIMD_WIDTH], nz[TERRAIN_SIMD_WIDTH];
+		for (; z + TERRAIN_SIMD_WIDTH <= n - 1; z += TERRAIN_SIMD_WIDTH) {
+#if defined(__AVX__)
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 dx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nextRow + z), _mm256_loadu_ps(prevRow + z)), _mm256_set1_ps(scaleX));
+			const __m256 dz = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(row + z + 1), _mm256_loadu_ps(row + z - 1)), _mm256_set1_ps(0.5f));
+			const __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dz, dz)), one));
+			const __m256 inv = _mm256_div_ps(one, length);
+			_mm256_storeu_ps(nx, _mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), dx), inv));
+			_mm256_storeu_ps(ny, inv);
+			_mm256_storeu_ps(nz, _mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), dz), inv));
+#else
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 dx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nextRow + z), _mm_loadu_ps(prevRow + z)), _mm_set1_ps(scaleX));
+			const __m128 dz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + z + 1), _mm_loadu_ps(row + z - 1)), _mm_set1_ps(0.5f));
+			const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz)), one));
+			const __m128 inv = _mm_div_ps(one, length);
+			_mm_storeu_ps(nx, _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), dx), inv));
+			_mm_storeu_ps(ny, inv);
+			_mm_storeu_ps(nz, _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), dz), inv));
+#endif
+			for (int lane = 0; lane < TERRAIN_SIMD_WIDTH; lane++)
+				normal[z + lane] = glm::vec3(nx[lane], ny[lane], nz[lane]);
+		}
+#endif
+		for (; z < n; z++)
+			scalarNormal(z);
+	}
+}
+
+// function to calculate "vertexNormal" - the rows are split into bands, one band per hardware thread
+void computeNormals(void) {
+	parallelFor(0, worldSize, computeNormalRows);
+}
+
+// function to build the splat map from "terrainHeights" and upload it to "splatTexture"
+// sand on the shore, forest high up and earth on steep slopes, grass elsewhere, with smooth transitions
+void initSplatMap(void) {
+	splatStep = 1;
+	while ((worldSize - 1) / splatStep + 1 > SPLAT_MAP_MAX_SIZE)
+		splatStep *= 2;
+	splatSize = (worldSize - 1) / splatStep + 1;
+
+	std::vector<unsigned char> weights((size_t)splatSize * splatSize * GROUND_LAYERS);
+	parallelFor(0, splatSize, [&](int firstRow, int lastRow) {
+		for (int row = firstRow; row < lastRow; row++) {
+			// the texture is indexed [Z][X] while "terrainHeights" is [X][Z]
+			const int gridZ = row * splatStep;
+			for (int column = 0; column < splatSize; column++) {
+				const int gridX = column * splatStep;
+				const int xM = glm::max(gridX - 1, 0), xP = glm::min(gridX + 1, worldSize - 1);
+				const int zM = glm::max(gridZ - 1, 0), zP = glm::min(gridZ + 1, worldSize - 1);
+				const float dx = (heightSample(xP, gridZ) - heightSample(xM, gridZ)) / (xP - xM);
+				const float dz = (heightSample(gridX, zP) - heightSample(gridX, zM)) / (zP - zM);
+				const float slope = sqrt(dx * dx + dz * dz);
+				const float height = heightSample(gridX, gridZ);
+
+				float weight[GROUND_LAYERS];
+				const float earth = glm::smoothstep(EARTH_SLOPE * 0.75f, EARTH_SLOPE * 1.25f, slope);
+				const float sand = (1.0f - earth) * (1.0f - glm::smoothstep(SAND_HEIGHT * 0.5f, SAND_HEIGHT * 1.5f, height));
+				const float forest = (1.0f - earth - sand) * glm::smoothstep(FOREST_HEIGHT * 0.8f, FOREST_HEIGHT * 1.2f, height);
+				weight[Texture::TEX_GRASS - Texture::TEX_GRASS] = 1.0f - earth - sand - forest;
+				weight[Texture::TEX_FOREST - Texture::TEX_GRASS] = forest;
+				weight[Texture::TEX_SAND - Texture::TEX_GRASS] = sand;
+				weight[Texture::TEX_EARTH - Texture::TEX_GRASS] = earth;
+				unsigned char* texel = &weights[((size_t)row * splatSize + column) * GROUND_LAYERS];
+				for (int layer = 0; layer < GROUND_LAYERS; layer++)
+					texel[layer] = (unsigned char)(glm::clamp(weight[layer], 0.0f, 1.0f) * 255.0f + 0.5f);
+			}
+		}
+	});
+
+	glGenTextures(1, &splatTexture);
+	glActiveTexture(GL_TEXTURE0 + SPLAT_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, splatTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, splatSize, splatSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, weights.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// function to fill "groundIndices" - for each level of detail a strip along Z for each row of quads of a chunk
+// and a strip for each skirt edge, separated by restart index
+void initChunkIndices(void) {
+	groundIndices.clear();
+	for (int level = 0; level < TERRAIN_LODS; level++) {
+		const int step = 1 << level;
+		lodIndexOffset[level] = groundIndices.size();
+		for (int x = 0; x < CHUNK_QUADS; x += step) {
+			for (int z = 0; z < CHUNK_SIZE; z += step) {
+				groundIndices.push_back(x * CHUNK_SIZE + z);
+				groundIndices.push_back((x + step) * CHUNK_SIZE + z);
+			}
+			groundIndices.push_back(RESTART_INDEX);
+		}
+		for (int edge = 0; edge < 4; edge++) {
+			for (int t = 0; t < CHUNK_SIZE; t += step) {
+				groundIndices.push_back(chunkEdgeVertex(edge, t));
+				groundIndices.push_back(CHUNK_GRID_VERTICES + edge * CHUNK_SIZE + t);
+			}
+			groundIndices.push_back(RESTART_INDEX);
+		}
+		lodIndexCount[level] = (GLsizei)(groundIndices.size() - lodIndexOffset[level]);
+	}
+}
+
+// function to get the grid vertex at T along skirt edge EDGE - X = 0, X = CHUNK_QUADS, Z = 0, Z = CHUNK_QUADS
+int chunkEdgeVertex(int edge, int t) {
+	const int x = edge == 0 ? 0 : edge == 1 ? CHUNK_QUADS : t;
+	const int z = edge == 2 ? 0 : edge == 3 ? CHUNK_QUADS : t;
+	return x * CHUNK_SIZE + z;
+}
+
+// function to take a chunk from the pool, or create its vertex array when the pool is empty
+terrainChunk acquireChunk(void) {
+	if (!chunkPool.empty()) {
+		terrainChunk chunk = chunkPool.back();
+		chunkPool.pop_back();
+		return chunk;
+	}
+
+	terrainChunk chunk;
+	glGenVertexArrays(1, &chunk.VAO);
+	glGenBuffers(1, &chunk.VBO);
+	glBindVertexArray(chunk.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, chunk.VBO);
+	glBufferData(GL_ARRAY_BUFFER, CHUNK_VERTICES * sizeof(terrain), NULL, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(terrain), (void*)offsetof(terrain, vertex));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(terrain), (void*)offsetof(terrain, normal));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(terrain), (void*)offsetof(terrain, tex_coord));
+	glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(terrain), (void*)offsetof(terrain, morph));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glEnableVertexAttribArray(5);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrainEBO);
+	glBindVertexArray(0);
+	return chunk;
+}
+
+// function to return an evicted chunk to the pool, or delete it when the pool is full
+void releaseChunk(terrainChunk chunk) {
+	if (chunkPool.size() < MAX_POOLED_CHUNKS) {
+		chunkPool.push_back(chunk);
+		return;
+	}
+	glDeleteVertexArrays(1, &chunk.VAO);
+	glDeleteBuffers(1, &chunk.VBO);
+}
+
+// function to pack the CHUNK_VERTICES vertices of chunk X Z from "terrainHeights" and "vertexNormal" into "ground"
+// the skirt hides what is left of a crack at the chunk border, e.g. beside a chunk that is not streamed in yet
+void packChunk(terrain* ground, int chunkX, int chunkZ) {
+	const float halfSize = (worldSize - 1) / 2.0f;
+
+	// coarsest level that still contains local sample X Z, and the height it morphs to when that level
+	// blends into the next one - the midpoint of the coarse edge or strip diagonal the sample lies on
+	auto morphTarget = [&](int x, int z) {
+		int level = 0;
+		while (level < TERRAIN_LODS - 1 && x % (2 << level) == 0 && z % (2 << level) == 0)
+			level++;
+		const int step = 1 << level;
+		const int gridX = chunkX * CHUNK_QUADS + x;
+		const int gridZ = chunkZ * CHUNK_QUADS + z;
+		const bool oddX = x % (2 * step) != 0;
+		const bool oddZ = z % (2 * step) != 0;
+		const float height =
+			level == TERRAIN_LODS - 1
+			? heightSample(gridX, gridZ)
+			: oddX && oddZ
+			? (heightSample(gridX + step, gridZ - step) + heightSample(gridX - step, gridZ + step)) / 2.0f
+			: oddX
+			? (heightSample(gridX - step, gridZ) + heightSample(gridX + step, gridZ)) / 2.0f
+			: (heightSample(gridX, gridZ - step) + heightSample(gridX, gridZ + step)) / 2.0f;
+		return glm::vec2(height, (float)level);
+	};
+
+	// texture repeats once per quad
+	for (int x = 0; x < CHUNK_SIZE; x++) {
+		for (int z = 0; z < CHUNK_SIZE; z++) {
+			const int gridX = chunkX * CHUNK_QUADS + x;
+			const int gridZ = chunkZ * CHUNK_QUADS + z;
+			const int i = x * CHUNK_SIZE + z;
+			ground[i].vertex = glm::vec3(gridX - halfSize, heightSample(gridX, gridZ), gridZ - halfSize);
+			ground[i].normal = vertexNormal[(size_t)gridX * worldSize + gridZ];
+			ground[i].tex_coord = glm::vec2(gridX, -gridZ);
+			ground[i].morph = morphTarget(x, z);
+		}
+	}
+
+	// skirt vertices keep the normal and morph of their edge sample so they shade and move with it
+	for (int edge = 0; edge < 4; edge++) {
+		for (int t = 0; t < CHUNK_SIZE; t++) {
+			terrain& skirt = ground[CHUNK_GRID_VERTICES + edge * CHUNK_SIZE + t];
+			skirt = ground[chunkEdgeVertex(edge, t)];
+			skirt.vertex.y -= SKIRT_DEPTH;
+			skirt.morph.x -= SKIRT_DEPTH;
+		}
+	}
+}
+
+// function to fill the vertex buffer of chunk X Z from the terrain cache, or pack it when there is no cache
+void buildChunk(terrainChunk& chunk, int chunkX, int chunkZ) {
+	static struct terrain scratch[CHUNK_VERTICES];
+	const terrain* ground = scratch;
+	if (cachedChunkVertices != NULL)
+		ground = cachedChunkVertices + ((size_t)chunkX * chunksPerDimension + chunkZ) * CHUNK_VERTICES;
+	else
+		packChunk(scratch, chunkX, chunkZ);
+
+	chunk.chunkX = chunkX;
+	chunk.chunkZ = chunkZ;
+	chunk.minHeight = ground[0].vertex.y;
+	chunk.maxHeight = ground[0].vertex.y;
+	for (int i = 1; i < CHUNK_VERTICES; i++) {
+		chunk.minHeight = glm::min(chunk.minHeight, ground[i].vertex.y);
+		chunk.maxHeight = glm::max(chunk.maxHeight, ground[i].vertex.y);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, chunk.VBO);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, CHUNK_VERTICES * sizeof(terrain), ground);
+}
+
+// function to map a whole file read-only into memory
+bool mapFile(const std::string path, mappedFile& mapped) {
+	mapped = {};
+#if defined(_WIN32)
+	mapped.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mapped.file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapped.file, &size) || size.QuadPart == 0) {
+		CloseHandle(mapped.file);
+		return false;
+	}
+	mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapped.mapping == NULL) {
+		CloseHandle(mapped.file);
+		return false;
+	}
+	mapped.data = (const char*)MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+	if (mapped.data == NULL) {
+		CloseHandle(mapped.mapping);
+		CloseHandle(mapped.file);
+		return false;
+	}
+	mapped.size = (size_t)size.QuadPart;
+#else
+	mapped.file = open(path.c_str(), O_RDONLY);
+	if (mapped.file < 0)
+		return false;
+	struct stat info;
+	if (fstat(mapped.file, &info) != 0 || info.st_size == 0) {
+		close(mapped.file);
+		return false;
+	}
+	void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, mapped.file, 0);
+	if (data == MAP_FAILED) {
+		close(mapped.file);
+		return false;
+	}
+	mapped.data = (const char*)data;
+	mapped.size = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+// function to release a file mapped by "mapFile"
+void unmapFile(mappedFile& mapped) {
+	if (mapped.data == NULL)
+		return;
+#if defined(_WIN32)
+	UnmapViewOfFile(mapped.data);
+	CloseHandle(mapped.mapping);
+	CloseHandle(mapped.file);
+#else
+	munmap((void*)mapped.data, mapped.size);
+	close(mapped.file);
+#endif
+	mapped = {};
+}
+
+// function to get the cache file name of the current seed and world size
+std::string terrainCachePath(void) {
+	return std::string(CACHE_DIR) + "/terrain_" + std::to_string(terrainSeed) + "_" + std::to_string(worldSize) + ".bin";
+}
+
+// function to get the expected cache header - generation parameters and section offsets
+terrainCacheHeader terrainCacheLayout(void) {
+	terrainCacheHeader header = {};
+	memcpy(header.magic, "TRNC", 4);
+	header.version = TERRAIN_CACHE_VERSION;
+	header.seed = terrainSeed;
+	header.worldSize = worldSize;
+	header.chunkQuads = CHUNK_QUADS;
+	header.terrainLods = TERRAIN_LODS;
+	header.vertexSize = sizeof(terrain);
+	header.maxHeight = (float)MAX_HEIGHT;
+	header.roughness = (float)ROUGHNESS;
+	memcpy(header.corners, TERRAIN_CORNERS, sizeof(TERRAIN_CORNERS));
+
+	// sections follow the header in this order, 16-byte aligned
+	auto align = [](uint64_t offset) { return (offset + 15) & ~(uint64_t)15; };
+	header.heightOffset = align(sizeof(terrainCacheHeader));
+	header.vertexOffset = align(header.heightOffset + (uint64_t)worldSize * worldSize * sizeof(float));
+	header.fileSize = header.vertexOffset + (uint64_t)chunksPerDimension * chunksPerDimension * CHUNK_VERTICES * sizeof(terrain);
+	return header;
+}
+
+// function to write "heightField" and the packed vertices of every chunk to the terrain cache
+// the file is written under a temporary name and renamed, so an interrupted run never leaves a partial cache
+bool writeTerrainCache(void) {
+	makeCacheDir();
+	const std::string path = terrainCachePath();
+	const std::string tempPath = path + ".tmp";
+	const terrainCacheHeader header = terrainCacheLayout();
+
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	static struct terrain ground[CHUNK_VERTICES];
+	const char padding[16] = {};
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(padding, 1, (size_t)(header.heightOffset - sizeof(header)), file) == header.heightOffset - sizeof(header)
+		&& fwrite(heightField.data(), sizeof(float), heightField.size(), file) == heightField.size();
+	const uint64_t heightEnd = header.heightOffset + heightField.size() * sizeof(float);
+	written = written && fwrite(padding, 1, (size_t)(header.vertexOffset - heightEnd), file) == header.vertexOffset - heightEnd;
+	for (int chunkX = 0; chunkX < chunksPerDimension && written; chunkX++) {
+		for (int chunkZ = 0; chunkZ < chunksPerDimension && written; chunkZ++) {
+			packChunk(ground, chunkX, chunkZ);
+			written = fwrite(ground, sizeof(terrain), CHUNK_VERTICES, file) == CHUNK_VERTICES;
+		}
+	}
+	written = fclose(file) == 0 && written;
+
+	remove(path.c_str());
+	if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+		remove(tempPath.c_str());
+		std::cout << "Failed to write terrain cache - " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// function to map the terrain cache of the current seed and world size
+// on success heights are read from the mapping and chunks are uploaded from "cachedChunkVertices", the generated
+// fields are released
+bool loadTerrainCache(void) {
+	unmapFile(terrainCache);
+	cachedChunkVertices = NULL;
+	terrainHeights = heightField.empty() ? NULL : heightField.data();
+	chunksPerDimension = (worldSize - 1) / CHUNK_QUADS;
+	if (!mapFile(terrainCachePath(), terrainCache))
+		return false;
+
+	// the whole header must match, including the section offsets and the file size
+	const terrainCacheHeader expected = terrainCacheLayout();
+	if (terrainCache.size != expected.fileSize || memcmp(terrainCache.data, &expected, sizeof(expected)) != 0) {
+		unmapFile(terrainCache);
+		return false;
+	}
+
+	terrainHeights = (const float*)(terrainCache.data + expected.heightOffset);
+	cachedChunkVertices = (const terrain*)(terrainCache.data + expected.vertexOffset);
+
+	// heights and normals are only kept to pack chunks, which the cache already holds
+	std::vector<float>().swap(heightField);
+	std::vector<glm::vec3>().swap(vertexNormal);
+	return true;
+}
+
+// function to get the distance on the XZ plane from "center" to the nearest point of chunk X Z
+float chunkDistance(int chunkX, int chunkZ, glm::vec3 center) {
+	const float halfSize = (worldSize - 1) / 2.0f;
+	const float minX = chunkX * CHUNK_QUADS - halfSize;
+	const float minZ = chunkZ * CHUNK_QUADS - halfSize;
+	const float dx = glm::max(glm::max(minX - center.x, center.x - (minX + CHUNK_QUADS)), 0.0f);
+	const float dz = glm::max(glm::max(minZ - center.z, center.z - (minZ + CHUNK_QUADS)), 0.0f);
+	return sqrt(dx * dx + dz * dz);
+}
+
+// function to pick the level of detail of a chunk from its distance to "center"
+int chunkLod(const terrainChunk& chunk, glm::vec3 center) {
+	const float distance = chunkDistance(chunk.chunkX, chunk.chunkZ, center);
+	int level = 0;
+	while (level < TERRAIN_LODS - 1 && distance >= LOD_DISTANCE * ((2 << level) - 1))
+		level++;
+	return level;
+}
+
+// function to build chunks within streaming distance of "center" and evict chunks that are far away
+// maxBuilds limits the uploads per call to avoid hitches, -1 builds every missing chunk
+void streamChunks(glm::vec3 center, int maxBuilds) {
+	const float halfSize = (worldSize - 1) / 2.0f;
+
+	// evict chunks beyond streaming distance, one chunk of hysteresis avoids rebuilding at the border
+	for (auto it = chunks.begin(); it != chunks.end();) {
+		if (chunkDistance(it->second.chunkX, it->second.chunkZ, center) > STREAM_DISTANCE + CHUNK_QUADS) {
+			releaseChunk(it->second);
+			it = chunks.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	// collect missing chunks within streaming distance, nearest first
+	std::vector<std::pair<float, std::pair<int, int>>> missing;
+	const int minChunkX = glm::max((int)floor((center.x - STREAM_DISTANCE + halfSize) / CHUNK_QUADS), 0);
+	const int maxChunkX = glm::min((int)floor((center.x + STREAM_DISTANCE + halfSize) / CHUNK_QUADS), chunksPerDimension - 1);
+	const int minChunkZ = glm::max((int)floor((center.z - STREAM_DISTANCE + halfSize) / CHUNK_QUADS), 0);
+	const int maxChunkZ = glm::min((int)floor((center.z + STREAM_DISTANCE + halfSize) / CHUNK_QUADS), chunksPerDimension - 1);
+	for (int chunkX = minChunkX; chunkX <= maxChunkX; chunkX++) {
+		for (int chunkZ = minChunkZ; chunkZ <= maxChunkZ; chunkZ++) {
+			const float distance = chunkDistance(chunkX, chunkZ, center);
+			if (distance <= STREAM_DISTANCE && chunks.find(std::make_pair(chunkX, chunkZ)) == chunks.end())
+				missing.push_back(std::make_pair(distance, std::make_pair(chunkX, chunkZ)));
+		}
+	}
+	std::sort(missing.begin(), missing.end());
+
+	for (size_t i = 0; i < missing.size() && (maxBuilds < 0 || (int)i < maxBuilds); i++) {
+		terrainChunk chunk = acquireChunk();
+		buildChunk(chunk, missing[i].second.first, missing[i].second.second);
+		chunks[missing[i].second] = chunk;
+	}
+}
+
+// function to get terrain height at world position X Z by bilinear interpolation of "terrainHeights"
+float terrainHeight(float x, float z) {
+	const float halfSize = (worldSize - 1) / 2.0f;
+	const float gridX = glm::clamp(x + halfSize, 0.0f, worldSize - 1.0f);
+	const float gridZ = glm::clamp(z + halfSize, 0.0f, worldSize - 1.0f);
+	const int x0 = glm::min((int)gridX, worldSize - 2);
+	const int z0 = glm::min((int)gridZ, worldSize - 2);
+	const float fx = gridX - x0;
+	const float fz = gridZ - z0;
+
+	return glm::mix(
+		glm::mix(heightSample(x0, z0), heightSample(x0 + 1, z0), fx),
+		glm::mix(heightSample(x0, z0 + 1), heightSample(x0 + 1, z0 + 1), fx),
+		fz);
+}
 
-bool useSuperman = false;
-bool useAntiAliasing = false;
-bool useTexture = true;
-bool useFog = false;
+// function to get the height of the ground or the water surface under the walking camera
+float cameraGround(void) {
+	return glm::max(terrainHeight(camX, camZ), 0.0f);
+}
 
-bool showMenu = false;
-int curTextLoc, startTextLoc;
+// function to get the position of the active camera
+glm::vec3 eyePosition(void) {
+	return useSuperman
+		? glm::vec3(supermanCamX, supermanCamY, supermanCamZ)
+		: glm::vec3(camX, camY, camZ);
+}
 
-// --------------------------------------------------------------------------------
-// Function prototypes
-// --------------------------------------------------------------------------------
+// function to get the approximate diameter in pixels of a bounding sphere on screen
+float projectedSize(glm::vec3 center, float radius) {
+	const float dist = glm::max(glm::distance(center, eyePosition()), radius);
+	return 2.0f * radius * lodPixelScale / dist;
+}
 
-GLuint loadShaders(const std::string, const std::string);
-unsigned int loadTexture(unsigned int ID, char* file);
-float randomize(double);
-glm::vec3 calculateNormal(glm::vec3, glm::vec3, glm::vec3);
-void generateTerrain(float, float, float, float);
-void init(void);
-void drawWater(void);
-void drawTerrain(void);
-void drawSky(void);
-void drawTree(float, float, float);
-void drawDuck(float, float, float, float, float);
-void drawGoat(float, float, float, float);
-int textLoc(void);
-void drawText(int, int, char*);
-void drawMenu(void);
-void display(void);
-void update(int);
-void updateFPS(int);
-void updateAnimals(int);
-void updateSuperman(int);
-void specialKey(int, int, int);
-void keyboardKey(unsigned char, int, int);
-int main(int, char**);
+// function to step a level of detail towards the level for "pixels", level 0 is the finest; a level boundary is
+// crossed only once the size is past the threshold by the hysteresis margin
+int selectLod(int level, float pixels, const float* thresholds, int levels) {
+	while (level > 0 && pixels > thresholds[level - 1] * (1.0f + LOD_HYSTERESIS))
+		level--;
+	while (level < levels - 1 && pixels < thresholds[level] * (1.0f - LOD_HYSTERESIS))
+		level++;
+	return level;
+}
 
-// --------------------------------------------------------------------------------
-// Functions
-// --------------------------------------------------------------------------------
+// function to extract the six clipping planes from a view-projection matrix
+void extractFrustum(glm::mat4 viewProj) {
+	// rows of the matrix, GLM matrices are column-major
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; i++)
+		row[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+
+	// left, right, bottom, top, near, far
+	for (int i = 0; i < 3; i++) {
+		frustumPlanes[i * 2] = row[3] + row[i];
+		frustumPlanes[i * 2 + 1] = row[3] - row[i];
+	}
+	for (int i = 0; i < 6; i++)
+		frustumPlanes[i] /= glm::length(glm::vec3(frustumPlanes[i]));
+}
 
-// function to load shaders
-GLuint loadShaders(const std::string vShaderFile, const std::string fShaderFile) {
-	GLint status;	// to check compile and linking status
-
-	// VERTEX SHADER
-	// load vertex shader code from file
-	std::string vShaderCodeStr;
-	std::ifstream vShaderStream(vShaderFile, std::ios::in);
-	if (vShaderStream.is_open()) {
-		// read from stream line by line and append it to shader code
-		std::string line = "";
-		while (std::getline(vShaderStream, line))
-			vShaderCodeStr += line + "\n";
-		vShaderStream.close();
+// function to test an axis-aligned box against "frustumPlanes", false if it is completely outside
+bool boxInFrustum(glm::vec3 minCorner, glm::vec3 maxCorner) {
+	for (int i = 0; i < 6; i++) {
+		// corner furthest along the plane normal
+		const glm::vec3 corner = glm::vec3(
+			frustumPlanes[i].x > 0 ? maxCorner.x : minCorner.x,
+			frustumPlanes[i].y > 0 ? maxCorner.y : minCorner.y,
+			frustumPlanes[i].z > 0 ? maxCorner.z : minCorner.z);
+		if (glm::dot(glm::vec3(frustumPlanes[i]), corner) + frustumPlanes[i].w < 0)
+			return false;
 	}
-	else {
-		// output error message and exit
-		std::cout << "Failed to open vertex shader file - " << vShaderFile << std::endl;
-		exit(EXIT_FAILURE);
+	return true;
+}
+
+// function to test a sphere against "frustumPlanes", false if it is completely outside
+bool sphereInFrustum(glm::vec3 center, float radius) {
+	for (int i = 0; i < 6; i++) {
+		if (glm::dot(glm::vec3(frustumPlanes[i]), center) + frustumPlanes[i].w < -radius)
+			return false;
+	}
+	return true;
+}
+
+// function to append a cube centered on the origin (same shape as glutSolidCube) to a mesh
+void appendCube(std::vector<meshVertex>& vertices, std::vector<GLuint>& indices,
+	glm::mat4 transform, float size, glm::vec3 color) {
+	const glm::mat3 normalMatrix = glm::mat3(transform);
+	const float h = size / 2.0f;
+
+	// one quad per face with its own normal, corners counter-clockwise seen from outside
+	for (int axis = 0; axis < 3; axis++) {
+		for (int sign = -1; sign <= 1; sign += 2) {
+			glm::vec3 n(0.0f), u(0.0f), v(0.0f);
+			n[axis] = (float)sign;
+			u[(axis + 1) % 3] = 1.0f;
+			v[(axis + 2) % 3] = (float)sign;
+			const GLuint first = (GLuint)vertices.size();
+			const glm::vec3 corners[4] = { n - u - v, n + u - v, n + u + v, n - u + v };
+			for (const glm::vec3& corner : corners)
+				vertices.push_back({ glm::vec3(transform * glm::vec4(corner * h, 1.0f)), glm::normalize(normalMatrix * n), color });
+			indices.insert(indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+		}
 	}
+}
 
-	// FRAGMENT SHADER
-	// load fragment shader code from file
-	std::string fShaderCodeStr;
-	std::ifstream fShaderStream(fShaderFile, std::ios::in);
-	if (fShaderStream.is_open()) {
-		// read from stream line by line and append it to shader code
-		std::string line = "";
-		while (std::getline(fShaderStream, line))
-			fShaderCodeStr += line + "\n";
-		fShaderStream.close();
+// function to append a closed cylinder along +Z (same shape as glutSolidCylinder) to a mesh
+void appendCylinder(std::vector<meshVertex>& vertices, std::vector<GLuint>& indices,
+	glm::mat4 transform, float radius, float height, int slices, glm::vec3 color) {
+	const glm::mat3 normalMatrix = glm::mat3(transform);
+	auto addVertex = [&](glm::vec3 v, glm::vec3 n) {
+		vertices.push_back({ glm::vec3(transform * glm::vec4(v, 1.0f)), glm::normalize(normalMatrix * n), color });
+	};
+
+	// side - one stack is enough, the lighting is identical along a straight side
+	const GLuint side = (GLuint)vertices.size();
+	for (int i = 0; i <= slices; i++) {
+		const float angle = 2.0f * glm::pi<float>() * i / slices;
+		const glm::vec3 n = glm::vec3(cos(angle), sin(angle), 0.0f);
+		addVertex(glm::vec3(n.x * radius, n.y * radius, 0.0f), n);
+		addVertex(glm::vec3(n.x * radius, n.y * radius, height), n);
 	}
-	else {
-		// output error message and exit
-		std::cout << "Failed to open fragment shader file - " << fShaderFile << std::endl;
-		exit(EXIT_FAILURE);
+	for (int i = 0; i < slices; i++) {
+		const GLuint a = side + i * 2;
+		indices.insert(indices.end(), { a, a + 2, a + 1, a + 1, a + 2, a + 3 });
 	}
 
-	// compile vertex shader
-	GLuint vShaderID = glCreateShader(GL_VERTEX_SHADER);
-	const GLchar* vShaderCode = vShaderCodeStr.c_str();
-	glShaderSource(vShaderID, 1, &vShaderCode, NULL);
+	// bottom and top caps as triangle fans around a center vertex
+	for (int cap = 0; cap < 2; cap++) {
+		const float z = cap == 0 ? 0.0f : height;
+		const glm::vec3 n = glm::vec3(0.0f, 0.0f, cap == 0 ? -1.0f : 1.0f);
+		const GLuint center = (GLuint)vertices.size();
+		addVertex(glm::vec3(0.0f, 0.0f, z), n);
+		for (int i = 0; i <= slices; i++) {
+			const float angle = 2.0f * glm::pi<float>() * i / slices;
+			addVertex(glm::vec3(cos(angle) * radius, sin(angle) * radius, z), n);
+		}
+		for (int i = 0; i < slices; i++)
+			indices.insert(indices.end(), { center, center + 1 + i, center + 2 + i });
+	}
+}
 
-	status = GL_FALSE;
-	glCompileShader(vShaderID);
-	glGetShaderiv(vShaderID, GL_COMPILE_STATUS, &status);
+// function to append a cone along +Z with a closed base (same shape as glutSolidCone) to a mesh
+void appendCone(std::vector<meshVertex>& vertices, std::vector<GLuint>& indices,
+	glm::mat4 transform, float base, float height, int slices, glm::vec3 color) {
+	const glm::mat3 normalMatrix = glm::mat3(transform);
+	auto addVertex = [&](glm::vec3 v, glm::vec3 n) {
+		vertices.push_back({ glm::vec3(transform * glm::vec4(v, 1.0f)), glm::normalize(normalMatrix * n), color });
+	};
+
+	// side normal leans towards the apex by the half-angle of the cone
+	const float slant = sqrt(height * height + base * base);
+	const float rNormal = height / slant;
+	const float zNormal = base / slant;
+
+	// side - base ring and apex, the apex is duplicated per slice to keep its normal
+	const GLuint side = (GLuint)vertices.size();
+	for (int i = 0; i <= slices; i++) {
+		const float angle = 2.0f * glm::pi<float>() * i / slices;
+		const glm::vec3 n = glm::vec3(cos(angle) * rNormal, sin(angle) * rNormal, zNormal);
+		addVertex(glm::vec3(cos(angle) * base, sin(angle) * base, 0.0f), n);
+		addVertex(glm::vec3(0.0f, 0.0f, height), n);
+	}
+	for (int i = 0; i < slices; i++) {
+		const GLuint a = side + i * 2;
+		indices.insert(indices.end(), { a, a + 2, a + 1 });
+	}
 
-	if (status == GL_FALSE) {
-		std::cout << "Failed to compile vertex shader - " << vShaderFile << std::endl;
-		int infoLogLength;
-		glGetShaderiv(vShaderID, GL_INFO_LOG_LENGTH, &infoLogLength);
-		char* errorMsg = new char[static_cast<__int64>(infoLogLength) + 1];
-		glGetShaderInfoLog(vShaderID, infoLogLength, NULL, errorMsg);
-		std::cout << errorMsg << std::endl;
-		delete[] errorMsg;
-		exit(EXIT_FAILURE);
+	// base cap
+	const glm::vec3 n = glm::vec3(0.0f, 0.0f, -1.0f);
+	const GLuint center = (GLuint)vertices.size();
+	addVertex(glm::vec3(0.0f), n);
+	for (int i = 0; i <= slices; i++) {
+		const float angle = 2.0f * glm::pi<float>() * i / slices;
+		addVertex(glm::vec3(cos(angle) * base, sin(angle) * base, 0.0f), n);
 	}
+	for (int i = 0; i < slices; i++)
+		indices.insert(indices.end(), { center, center + 1 + i, center + 2 + i });
+}
 
-	// compile fragment shader
-	GLuint fShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-	const GLchar* fShaderCode = fShaderCodeStr.c_str();
-	glShaderSource(fShaderID, 1, &fShaderCode, NULL);
+// function to bake the tree mesh once per level of detail from cached parts into the mesh cache, and set up the
+// impostor quad and its per-instance positions
+void initTrees(void) {
+	const glm::vec3 treeColor = glm::vec3(0.1, 0.9, 0.2);
+	const glm::vec3 woodColor = glm::vec3(0.7, 0.6, 0.5);
+	std::vector<meshVertex> vertices;
+	std::vector<GLuint> indices;
+
+	// tree parts in tree space, the origin is the base of the lowest cone
+	// every level of detail is baked after the previous one in the same buffers
+	const glm::mat4 down = glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(1.0, 0.0, 0.0));
+	const glm::mat4 up = glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1.0, 0.0, 0.0));
+	for (int level = 0; level < TREE_MESH_LODS; level++) {
+		std::vector<meshVertex> lodVertices;
+		std::vector<GLuint> lodIndices;
+		const int slices = TREE_LOD_SLICES[level];
+		appendCachedMesh(lodVertices, lodIndices, cachedMesh(Shape::SHAPE_CYLINDER, 0.3f, 2.5f, slices), down, woodColor);
+		appendCachedMesh(lodVertices, lodIndices, cachedMesh(Shape::SHAPE_CONE, 1.6f, 1.5f, slices), up, treeColor);
+		appendCachedMesh(lodVertices, lodIndices, cachedMesh(Shape::SHAPE_CONE, 1.4f, 1.5f, slices),
+			glm::translate(glm::mat4(1.0f), glm::vec3(0.0, 1.0, 0.0)) * up, treeColor);
+		appendCachedMesh(lodVertices, lodIndices, cachedMesh(Shape::SHAPE_CONE, 1.2f, 1.5f, slices),
+			glm::translate(glm::mat4(1.0f), glm::vec3(0.0, 2.0, 0.0)) * up, treeColor);
+		treeMeshes[level] = addCachedMesh(lodVertices, lodIndices);
+	}
 
-	status = GL_FALSE;
-	glCompileShader(fShaderID);
-	glGetShaderiv(fShaderID, GL_COMPILE_STATUS, &status);
+	// impostor quad, the vertex shader turns and scales it to the tree bounds
+	const glm::vec2 corners[4] = { glm::vec2(-1, -1), glm::vec2(1, -1), glm::vec2(1, 1), glm::vec2(-1, 1) };
+	for (const glm::vec2& corner : corners)
+		vertices.push_back({ glm::vec3(corner, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f) });
+	indices.insert(indices.end(), { 0, 1, 2, 0, 2, 3 });
 
-	if (status == GL_FALSE) {
-		std::cout << "Failed to compile fragment shader - " << fShaderFile << std::endl;
-		int infoLogLength;
-		glGetShaderiv(fShaderID, GL_INFO_LOG_LENGTH, &infoLogLength);
-		char* errorMsg = new char[static_cast<__int64>(infoLogLength) + 1];
-		glGetShaderInfoLog(fShaderID, infoLogLength, NULL, errorMsg);
-		std::cout << errorMsg << std::endl;
-		delete[] errorMsg;
-		exit(EXIT_FAILURE);
+	// hand-placed trees, then scatter the extra trees randomly over land
+	treeInstances.clear();
+	for (int i = 0; i < NUM_OF_TREES; i++)
+		treeInstances.push_back(glm::vec4(treesCoord[i], 1.0f));
+
+	const float halfSize = (worldSize - 1) / 2.0f;
+	for (int i = 0, attempts = 0; i < extraTrees && attempts < extraTrees * 20; attempts++) {
+		const float x = randomize(halfSize);
+		const float z = randomize(halfSize);
+		const float y = terrainHeight(x, z);
+		if (y < 1.0f)
+			continue;
+		// sink the trunk a little so trees on slopes do not float
+		treeInstances.push_back(glm::vec4(x, y + 2.0f, z, 1.0f + randomize(0.2)));
+		i++;
 	}
+	treeLevels.assign(treeInstances.size(), TREE_MESH_LODS - 1);
+
+	glBindVertexArray(VAO[TREE_OBJ]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO[TREE_OBJ]);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(meshVertex), vertices.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(meshVertex), (void*)offsetof(meshVertex, vertex));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(meshVertex), (void*)offsetof(meshVertex, normal));
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(meshVertex), (void*)offsetof(meshVertex, color));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(3);
+
+	glGenBuffers(1, &treeEBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, treeEBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &treeInstanceVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, treeInstanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, treeInstances.size() * sizeof(glm::vec4), treeInstances.data(), GL_STREAM_DRAW);
+	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
+	glVertexAttribDivisor(4, 1);
+	glEnableVertexAttribArray(4);
+	glBindVertexArray(0);
+}
 
-	// create program
-	GLuint programID = glCreateProgram();
-	// attach shaders to program object
-	glAttachShader(programID, vShaderID);
-	glAttachShader(programID, fShaderID);
-	// link program object
-	glLinkProgram(programID);
-
-	// check link status
-	status = GL_FALSE;
-	glGetProgramiv(programID, GL_LINK_STATUS, &status);
+// function to add an animal walking along X between "minX" and "maxX", "heading" is +1 or -1
+void addAnimal(Species kind, glm::vec3 position, float heading, float minX, float maxX) {
+	const speciesInfo& info = speciesInfos[kind];
+	animals.species.push_back((unsigned char)kind);
+	animals.level.push_back(0);
+	animals.x.push_back(position.x);
+	animals.y.push_back(position.y);
+	animals.z.push_back(position.z);
+	animals.previousX.push_back(position.x);
+	animals.heading.push_back(heading);
+	animals.speed.push_back(ANIMAL_SPEED);
+	animals.rotation.push_back(0.0f);
+	animals.previousRotation.push_back(0.0f);
+	animals.wobble.push_back(info.wobble);
+	animals.minX.push_back(minX);
+	animals.maxX.push_back(maxX);
+	animals.boundsHeight.push_back(info.boundsHeight);
+	animals.boundsRadius.push_back(info.boundsRadius);
+}
 
-	if (status == GL_FALSE) {
-		std::cout << "Failed to link program object." << std::endl;
-		int infoLogLength;
-		glGetShaderiv(programID, GL_INFO_LOG_LENGTH, &infoLogLength);
-		char* errorMsg = new char[static_cast<__int64>(infoLogLength) + 1];
-		glGetShaderInfoLog(programID, infoLogLength, NULL, errorMsg);
-		std::cout << errorMsg << std::endl;
-		delete[] errorMsg;
-		exit(EXIT_FAILURE);
+// function to add the hand-placed animals, then scatter the extra ones - ducks on water, goats on land
+void initAnimals(void) {
+	addAnimal(Species::SPECIES_DUCK, glm::vec3(WORLD_SIZE / 5, 0, 0), +1.0f, 0, WORLD_SIZE / 3);
+	addAnimal(Species::SPECIES_DUCK, glm::vec3(0, 0, WORLD_SIZE / 5), -1.0f, 0, WORLD_SIZE / 3);
+	addAnimal(Species::SPECIES_GOAT, glm::vec3(-WORLD_SIZE / 3, 1.5f, -WORLD_SIZE / 10), +1.0f, -WORLD_SIZE / 3, -WORLD_SIZE / 5);
+	addAnimal(Species::SPECIES_GOAT, glm::vec3(-WORLD_SIZE / 4, 1.7f, +WORLD_SIZE / 10), -1.0f, -WORLD_SIZE / 3, -WORLD_SIZE / 5);
+
+	const float halfSize = (worldSize - 1) / 2.0f;
+	for (int i = 0, attempts = 0; i < extraAnimals && attempts < extraAnimals * 20; attempts++) {
+		const float x = randomize(halfSize);
+		const float z = randomize(halfSize);
+		const float y = terrainHeight(x, z);
+		const float heading = rand() % 2 == 0 ? +1.0f : -1.0f;
+		if (y < -0.5f)
+			addAnimal(Species::SPECIES_DUCK, glm::vec3(x, 0.0f, z), heading, x - 10.0f, x + 10.0f);
+		else if (y > 1.0f)
+			addAnimal(Species::SPECIES_GOAT, glm::vec3(x, y, z), heading, x - 10.0f, x + 10.0f);
+		else
+			continue;
+		i++;
 	}
+}
 
-	return programID;
+// function to create the impostor atlas and bake the tree views into it, trees stay meshes if that fails
+void initImpostors(void) {
+	glGenTextures(1, &impostorTexture);
+	glActiveTexture(GL_TEXTURE0 + IMPOSTOR_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, impostorTexture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, IMPOSTOR_VIEWS * IMPOSTOR_TILE_WIDTH, IMPOSTOR_TILE_HEIGHT, 2,
+		0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	if (bakeImpostors())
+		treeLodCount = TREE_LODS;
+	else
+		std::cout << "Tree impostors disabled, the impostor atlas could not be rendered" << std::endl;
 }
 
-// function to load textures
-unsigned int loadTexture(unsigned int ID, char* file) {
-	unsigned int textureID;
-	// generate 1 texture with ID of "textureID"
-	glGenTextures(1, &textureID);
-	// activate the texture unit first before binding texture
-	glActiveTexture(GL_TEXTURE0 + ID);
-	// bind textureID before use
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	int width, height, nrChannels;
-	unsigned char* data = stbi_load(file, &width, &height, &nrChannels, 0);
-
-	if (data) {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		// set texture behaviour
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// function to render the finest tree mesh from IMPOSTOR_VIEWS directions around its vertical axis into the
+// impostor atlas - orthographic views of the tree bounds, one tile per view
+bool bakeImpostors(void) {
+	GLint previousFramebuffer, previousViewport[4];
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+	GLuint framebuffer, depthBuffer;
+	glGenFramebuffers(1, &framebuffer);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, IMPOSTOR_VIEWS * IMPOSTOR_TILE_WIDTH, IMPOSTOR_TILE_HEIGHT);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, impostorTexture, 0, 0);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, impostorTexture, 0, 1);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+
+	const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	if (complete) {
+		// transparent black around the tree, so filtered texels can be divided by their coverage
+		GLfloat clearColor[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glEnable(GL_DEPTH_TEST);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+		// a single tree at the origin, the finest level from the mesh cache
+		uploadMeshCache();
+		glBindVertexArray(VAO[GLUT_OBJ]);
+		useObjectProgram(Object::OBJ_TREE);
+		setObjectUniforms(glm::mat4(1.0f), glm::vec3(1.0f));
+
+		// view N looks at the tree from angle N / IMPOSTOR_VIEWS of a turn, measured from +Z towards +X
+		frameUniforms frame = {};
+		frame.proj = glm::ortho(-IMPOSTOR_HALF_SIZE.x, IMPOSTOR_HALF_SIZE.x, -IMPOSTOR_HALF_SIZE.y, IMPOSTOR_HALF_SIZE.y, 0.1f, 20.0f);
+		const meshRange& mesh = cachedMeshes[treeMeshes[0]];
+		for (int i = 0; i < IMPOSTOR_VIEWS; i++) {
+			const float angle = 2.0f * glm::pi<float>() * i / IMPOSTOR_VIEWS;
+			const glm::vec3 direction = glm::vec3(sin(angle), 0.0f, cos(angle));
+			frame.view = glm::lookAt(TREE_BOUNDS_CENTER + direction * 10.0f, TREE_BOUNDS_CENTER, glm::vec3(0.0f, 1.0f, 0.0f));
+			writeUniformBlock(FRAME_UNIFORM_BINDING, &frame, sizeof(frame));
+			glViewport(i * IMPOSTOR_TILE_WIDTH, 0, IMPOSTOR_TILE_WIDTH, IMPOSTOR_TILE_HEIGHT);
+			glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT,
+				(void*)(mesh.firstIndex * sizeof(GLuint)), mesh.baseVertex);
+		}
+		glBindVertexArray(0);
 	}
-	else {
-		std::cout << "Failed to load texture" << std::endl;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+	glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &depthBuffer);
+
+	if (complete) {
+		glActiveTexture(GL_TEXTURE0 + IMPOSTOR_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, impostorTexture);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
 	}
-	stbi_image_free(data);
+	return complete;
+}
 
-	return textureID;
+// function to find a mesh in the mesh cache, tessellating it on first use
+int cachedMesh(Shape shape, float size, float height, int slices) {
+	// the cube has no slices, keep a single entry per size
+	const meshKey key = { shape, size, shape == Shape::SHAPE_CUBE ? size : height, shape == Shape::SHAPE_CUBE ? 0 : slices };
+	auto found = meshIds.find(key);
+	if (found != meshIds.end())
+		return found->second;
+
+	std::vector<meshVertex> vertices;
+	std::vector<GLuint> indices;
+	if (shape == Shape::SHAPE_CUBE)
+		appendCube(vertices, indices, glm::mat4(1.0f), size, glm::vec3(1.0f));
+	else if (shape == Shape::SHAPE_CONE)
+		appendCone(vertices, indices, glm::mat4(1.0f), size, height, slices, glm::vec3(1.0f));
+	else
+		appendCylinder(vertices, indices, glm::mat4(1.0f), size, height, slices, glm::vec3(1.0f));
+	const int id = addCachedMesh(vertices, indices);
+	meshIds[key] = id;
+	return id;
 }
 
-// function to generate a random value between [-d, +d]
-float randomize(double d) {
-	float randVal = ((float)rand()) / (float)RAND_MAX;
-	return (randVal * 2 * (float)d) - (float)d;
+// function to add a mesh to the mesh cache, its indices counted from its first vertex - returns the id of the mesh
+int addCachedMesh(const std::vector<meshVertex>& vertices, const std::vector<GLuint>& indices) {
+	const size_t firstVertex = meshCacheVertices.size();
+	const size_t firstIndex = meshCacheIndices.size();
+	meshCacheVertices.insert(meshCacheVertices.end(), vertices.begin(), vertices.end());
+	meshCacheIndices.insert(meshCacheIndices.end(), indices.begin(), indices.end());
+
+	const int id = (int)cachedMeshes.size();
+	cachedMeshes.push_back({ (GLsizei)indices.size(), (GLuint)firstIndex, (GLint)firstVertex, (GLsizei)vertices.size() });
+	queuedParts.resize(cachedMeshes.size());
+	meshCacheDirty = true;
+	return id;
 }
 
-// function to calculate normal vector based on vector cross-product
-glm::vec3 calculateNormal(glm::vec3 A, glm::vec3 B, glm::vec3 C) {
-	return glm::normalize(glm::cross(B - A, C - A));
+// function to append cached mesh "mesh" to a mesh, moved by "transform" and painted "color"
+void appendCachedMesh(std::vector<meshVertex>& vertices, std::vector<GLuint>& indices, int mesh,
+	glm::mat4 transform, glm::vec3 color) {
+	const meshRange& range = cachedMeshes[mesh];
+	const glm::mat3 normalMatrix = glm::mat3(transform);
+	const GLuint first = (GLuint)vertices.size();
+	for (GLsizei i = 0; i < range.vertexCount; i++) {
+		const meshVertex& cached = meshCacheVertices[range.baseVertex + i];
+		vertices.push_back({ glm::vec3(transform * glm::vec4(cached.vertex, 1.0f)), glm::normalize(normalMatrix * cached.normal), color });
+	}
+	for (GLsizei i = 0; i < range.indexCount; i++)
+		indices.push_back(first + meshCacheIndices[range.firstIndex + i]);
 }
 
-// function to generate terrain data and store in array of "ground"
-void generateTerrain(float UL, float LL, float LR, float UR) {
-	int i = WORLD_SIZE;
-	int midX, midZ;
-	double d = MAX_HEIGHT;
-	// initial height at the 4 corners of the terrain
-	const int first = 0;
-	const int last = WORLD_SIZE - 1;
-	heightField[first][first] = UL;
-	heightField[first][last] = LL;
-	heightField[last][last] = LR;
-	heightField[last][first] = UR;
+// function to upload the mesh cache to the buffers of VAO[GLUT_OBJ] after meshes were added
+void uploadMeshCache(void) {
+	if (!meshCacheDirty)
+		return;
+	glBindVertexArray(VAO[GLUT_OBJ]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO[GLUT_OBJ]);
+	glBufferData(GL_ARRAY_BUFFER, meshCacheVertices.size() * sizeof(meshVertex), meshCacheVertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, partEBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshCacheIndices.size() * sizeof(GLuint), meshCacheIndices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	meshCacheDirty = false;
+}
 
-	// calculate height of ground - using midpoint displacement algorithm
-	while (i > 1) {
-		for (int x = 0; x < WORLD_SIZE; x += i) {
-			for (int z = 0; z < WORLD_SIZE; z += i) {
-				// square step
-				midX = x + i / 2;
-				midZ = z + i / 2;
-
-				const float x0z0 = heightField[x][z];
-				const float xiz0 = x + i < WORLD_SIZE ? heightField[x + i][z] : x0z0;
-				const float x0zi = z + i < WORLD_SIZE ? heightField[x][z + i] : x0z0;
-				const float xizi = (x + i < WORLD_SIZE) && (z + i < WORLD_SIZE) ? heightField[x + i][z + i] : x0z0;
-				const float xMidzMid = (x0z0 + x0zi + xizi + xiz0) / 4 + randomize(d);
-
-				// diamond steps
-				heightField[midX][midZ] = xMidzMid;
-				heightField[x][midZ] = (x0z0 + x0zi + xMidzMid) / 3 + randomize(d);
-				heightField[midX][z] = (x0z0 + xiz0 + xMidzMid) / 3 + randomize(d);
-				if (x + i < WORLD_SIZE) heightField[x + i][midZ] = (float)((xizi + xiz0 + xMidzMid) / 3 + randomize(d));
-				if (z + i < WORLD_SIZE) heightField[midX][z + i] = (float)((x0zi + xizi + xMidzMid) / 3 + randomize(d));
-			}
-		}
-		i /= 2;
-		d *= glm::pow(2, -ROUGHNESS);
+// function to set up the buffers of VAO[GLUT_OBJ] and warm the mesh cache with the shapes of the animals
+void initParts(void) {
+	useMultiDrawIndirect = GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+
+	glGenBuffers(1, &partEBO);
+	glBindVertexArray(VAO[GLUT_OBJ]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO[GLUT_OBJ]);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(meshVertex), (void*)offsetof(meshVertex, vertex));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(meshVertex), (void*)offsetof(meshVertex, normal));
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(meshVertex), (void*)offsetof(meshVertex, color));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(3);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, partEBO);
+
+	glGenBuffers(1, &partInstanceVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, partInstanceVBO);
+	setPartAttributes(0);
+	for (int i = 0; i < 5; i++) {
+		glVertexAttribDivisor(6 + i, 1);
+		glEnableVertexAttribArray(6 + i);
 	}
+	glBindVertexArray(0);
 
-	// calculate normal vector
-	const float halfSize = (WORLD_SIZE - 1) / 2.0f;
-	for (int x = 0; x < WORLD_SIZE; x++)
-		for (int z = 0; z < WORLD_SIZE; z++)
-			vertexCoord[x][z] = glm::vec3(x - halfSize, heightField[x][z], z - halfSize);
+	glGenBuffers(1, &partIndirectBuffer);
 
-	// calculate normal vector for each vertex of terrain
-	for (int x = 0; x < WORLD_SIZE; x++) {
-		for (int z = 0; z < WORLD_SIZE; z++) {
-			// P = Plus 1, M = Minus 1
-			const glm::vec3 x0z0 = vertexCoord[x][z];
-			const glm::vec3 xPz0 = vertexCoord[x + 1][z];
-			const glm::vec3 x0zP = vertexCoord[x][z + 1];
-			const glm::vec3 xPzP = vertexCoord[x + 1][z + 1];
-			const glm::vec3 xMz0 = x - 1 >= 0 ? vertexCoord[x - 1][z] : x0z0;
-			const glm::vec3 x0zM = z - 1 >= 0 ? vertexCoord[x][z - 1] : x0z0;
-
-			vertexNormal[x][z] =
-				x == 0 && z == 0
-				? calculateNormal(x0z0, x0zP, xPz0)
-				: x == WORLD_SIZE - 1 && z == 0
-				? calculateNormal(x0z0, xMz0, x0zP)
-				: x == 0 && z == WORLD_SIZE - 1
-				? calculateNormal(x0z0, xPz0, x0zM)
-				: x == WORLD_SIZE - 1 && z == WORLD_SIZE - 1
-				? calculateNormal(x0z0, x0zM, xMz0)
-				: x == 0
-				? glm::normalize((calculateNormal(x0z0, xPzP, x0zM) + calculateNormal(x0z0, x0zP, xPzP)) / 2.0f)
-				: x == WORLD_SIZE - 1
-				? glm::normalize((calculateNormal(x0z0, x0zM, xMz0) + calculateNormal(x0z0, xMz0, x0zP)) / 2.0f)
-				: z == 0
-				? glm::normalize((calculateNormal(x0z0, xMz0, x0zP) + calculateNormal(x0z0, x0zP, xPz0)) / 2.0f)
-				: z == WORLD_SIZE - 1
-				? glm::normalize((calculateNormal(x0z0, x0zM, xMz0) + calculateNormal(x0z0, xPz0, x0zM)) / 2.0f)
-				: glm::normalize((
-					calculateNormal(x0z0, xMz0, x0zP) +
-					calculateNormal(x0z0, x0zP, xPz0) +
-					calculateNormal(x0z0, xPz0, x0zM) +
-					calculateNormal(x0z0, x0zM, xMz0)) / 4.0f);
-		}
-	}
+	cachedMesh(Shape::SHAPE_CUBE, 1.0f, 1.0f, 0);
+	uploadMeshCache();
+}
+
+// function to point the part instance attributes at "partInstanceVBO", starting at instance "first"
+void setPartAttributes(GLuint first) {
+	const size_t base = first * sizeof(partInstance);
+	for (int column = 0; column < 4; column++)
+		glVertexAttribPointer(6 + column, 4, GL_FLOAT, GL_FALSE, sizeof(partInstance),
+			(void*)(base + offsetof(partInstance, model) + column * sizeof(glm::vec4)));
+	glVertexAttribPointer(10, 4, GL_FLOAT, GL_FALSE, sizeof(partInstance), (void*)(base + offsetof(partInstance, color)));
+}
 
-	// fill in data to "ground" array
-	i = 0;
-	for (int x = 0; x < WORLD_SIZE - 1; x++) {
-		for (int z = 0; z < WORLD_SIZE - 1; z++) {
-			ground[i].vertex = glm::vec3(x - halfSize, heightField[x][z], z - halfSize);
-			ground[i].normal = vertexNormal[x][z];
-			ground[i++].tex_coord = glm::vec2(0.0, 1.0);
+// function to queue one part drawn with cached mesh "mesh" for "drawParts"
+void queuePart(int mesh, const glm::mat4& partModel, const glm::vec3& color) {
+	queuedParts[mesh].push_back({ partModel, glm::vec4(color, 1.0f) });
+}
 
-			ground[i].vertex = glm::vec3(x - halfSize, heightField[x][z + 1], z + 1 - halfSize);
-			ground[i].normal = vertexNormal[x][z + 1];
-			ground[i++].tex_coord = glm::vec2(0.0, 0.0);
+// function to draw every queued part - all instances of a mesh are consecutive in "partInstances", so each
+// mesh with queued parts is one command whose base instance is the start of its run
+void drawParts(void) {
+	partInstances.clear();
+	partCommands.clear();
+	for (size_t mesh = 0; mesh < cachedMeshes.size(); mesh++) {
+		if (queuedParts[mesh].empty())
+			continue;
+		const meshRange& range = cachedMeshes[mesh];
+		partCommands.push_back({ (GLuint)range.indexCount, (GLuint)queuedParts[mesh].size(), range.firstIndex, range.baseVertex, (GLuint)partInstances.size() });
+		partInstances.insert(partInstances.end(), queuedParts[mesh].begin(), queuedParts[mesh].end());
+		queuedParts[mesh].clear();
+	}
+	if (partInstances.empty())
+		return;
+	uploadMeshCache();
 
-			ground[i].vertex = glm::vec3(x + 1 - halfSize, heightField[x + 1][z + 1], z + 1 - halfSize);
-			ground[i].normal = vertexNormal[x + 1][z + 1];
-			ground[i++].tex_coord = glm::vec2(1.0, 0.0);
+	// the buffers are orphaned every frame, the driver hands out fresh storage while the last frame still draws
+	glBindVertexArray(VAO[GLUT_OBJ]);
+	glBindBuffer(GL_ARRAY_BUFFER, partInstanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, partInstances.size() * sizeof(partInstance), partInstances.data(), GL_STREAM_DRAW);
+
+	useObjectProgram(Object::OBJ_GLUT);
+	setObjectUniforms(glm::mat4(1.0f), glm::vec3(1.0f));
+
+	if (useMultiDrawIndirect) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, partIndirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, partCommands.size() * sizeof(drawElementsIndirectCommand), partCommands.data(), GL_STREAM_DRAW);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, (GLsizei)partCommands.size(), sizeof(drawElementsIndirectCommand));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		return;
+	}
 
-			ground[i].vertex = glm::vec3(x + 1 - halfSize, heightField[x + 1][z], z - halfSize);
-			ground[i].normal = vertexNormal[x + 1][z];
-			ground[i++].tex_coord = glm::vec2(1.0, 1.0);
-		}
+	// without base instance the attributes are moved to the first instance of each mesh instead
+	for (const drawElementsIndirectCommand& command : partCommands) {
+		setPartAttributes(command.baseInstance);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+			(void*)(command.firstIndex * sizeof(GLuint)), command.instanceCount, command.baseVertex);
 	}
+	setPartAttributes(0);
 }
 
 // function to initialize the program
 void init(void) {
-	generateTerrain(5.0f, 1.0f, -5.0f, 5.0f);
+	// terrain from the cache, or generated and cached for the next run
+	if (!loadTerrainCache()) {
+		generateTerrain(TERRAIN_CORNERS[0], TERRAIN_CORNERS[1], TERRAIN_CORNERS[2], TERRAIN_CORNERS[3], terrainSeed);
+		if (writeTerrainCache())
+			loadTerrainCache();
+	}
 
 	glGenVertexArrays(VAO_SIZE, VAO);
 	glGenBuffers(VAO_SIZE, VBO);
 
-	// 0 - terrain
+	// 0 - water
 	glBindVertexArray(VAO[Background::BG_WATER]);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO[Background::BG_WATER]);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(water), water, GL_DYNAMIC_DRAW);
@@ -440,18 +2823,7 @@ void init(void) {
 	glEnableVertexAttribArray(1);
 	glEnableVertexAttribArray(2);
 
-	// 1 - water
-	glBindVertexArray(VAO[Background::BG_TERRAIN]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO[Background::BG_TERRAIN]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(ground), ground, GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-
-	// 2 - sky
+	// 1 - sky
 	glBindVertexArray(VAO[Background::BG_SKY]);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO[Background::BG_SKY]);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(sky), sky, GL_DYNAMIC_DRAW);
@@ -462,171 +2834,168 @@ void init(void) {
 	glEnableVertexAttribArray(1);
 	glEnableVertexAttribArray(2);
 
-	// 3 - GLUT objects
-	glBindVertexArray(VAO[GLUT_OBJ]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO[GLUT_OBJ]);
-	glutSetVertexAttribCoord3(0);
-	glutSetVertexAttribNormal(1);
+	// 2 - animal parts
+	initParts();
 
-	// program
-	program = loadShaders("vertexShader.glsl", "fragmentShader.glsl");
-	glUseProgram(program);
+	// 3 - trees
+	initTrees();
+
+	// animals, drawn as parts on VAO[GLUT_OBJ]
+	initAnimals();
+
+	// terrain chunks around the starting camera, all chunks share one index buffer
+	initChunkIndices();
+	glGenBuffers(1, &terrainEBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrainEBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, groundIndices.size() * sizeof(GLushort), groundIndices.data(), GL_STATIC_DRAW);
+	streamChunks(eyePosition(), -1);
+
+	// programs and their uniform blocks
+	initShaderVariants();
+	initUniformRing();
+
+	// distant tree views, rendered with the tree program
+	initImpostors();
 
 	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_PRIMITIVE_RESTART);
+	glPrimitiveRestartIndex(RESTART_INDEX);
 	glClearColor((GLclampf)0.3, (GLclampf)0.3, (GLclampf)0.3, (GLclampf)1.0);
 
 	// projection matrix (fov, aspect, near, far)
 	proj = glm::perspective(glm::radians(45.0f), 1.8f, 0.1f, 200.0f);
-	unsigned int projLoc = glGetUniformLocation(program, "proj");
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(proj));
-
-	// fog
-	unsigned int fogStartLoc = glGetUniformLocation(program, "fogStart");
-	glUniform1f(fogStartLoc, WORLD_SIZE / 5.0f);
-	unsigned int fogEndLoc = glGetUniformLocation(program, "fogEnd");
-	glUniform1f(fogEndLoc, WORLD_SIZE / 1.5f);
-
-	// texture
-	char texWater[50] = "textures/water.jpg";
-	char texGround1[50] = "textures/grass.jpg";
-	char texGround2[50] = "textures/forest.jpg";
-	char texGround3[50] = "textures/sand.jpg";
-	char texGround4[50] = "textures/earth.jpg";
-	char texSky[50] = "textures/sky.jpg";
-	textureID[Texture::TEX_WATER] = loadTexture(Texture::TEX_WATER, texWater);
-	textureID[Texture::TEX_GRASS] = loadTexture(Texture::TEX_GRASS, texGround1);
-	textureID[Texture::TEX_FOREST] = loadTexture(Texture::TEX_FOREST, texGround2);
-	textureID[Texture::TEX_SAND] = loadTexture(Texture::TEX_SAND, texGround3);
-	textureID[Texture::TEX_EARTH] = loadTexture(Texture::TEX_EARTH, texGround4);
-	textureID[Texture::TEX_SKY] = loadTexture(Texture::TEX_SKY, texSky);
-
-	glutFullScreen();
+
+	// texture - decoded in the background, the scene starts with placeholder colors
+	startTextureLoading();
+	initSplatMap();
+	setConstantUniforms();
+
+	// edits to the shader files are picked up while running
+	initShaderWatch();
+
+	// benchmark renders offscreen, so keep the (hidden) window as it is
+	if (!useBenchmark)
+		glutFullScreen();
 }
 
 // function to draw water
 void drawWater(void) {
+	totalObjects++;
+	if (!boxInFrustum(glm::vec3(-worldSize / 2.0f, 0.0f, -worldSize / 2.0f), glm::vec3(worldSize / 2.0f, 0.0f, worldSize / 2.0f))) {
+		culledObjects++;
+		return;
+	}
+
 	glBindVertexArray(VAO[Background::BG_WATER]);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO[Background::BG_WATER]);
 
-	unsigned int objLoc = glGetUniformLocation(program, "obj");
-	unsigned int modelLoc = glGetUniformLocation(program, "model");
-	unsigned int vColorLoc = glGetUniformLocation(program, "vColor");
-	unsigned int ourTextureLoc = glGetUniformLocation(program, "ourTexture");
+	useObjectProgram(Object::OBJ_GROUND);
 
-	object = Object::OBJ_GROUND;
-	glUniform1i(objLoc, object);
+	model = glm::scale(glm::mat4(1.0f), glm::vec3((float)worldSize));
+	setObjectUniforms(model, glm::vec3(0.3, 0.3, 0.8));
 
-	model = glm::mat4(1.0f);
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(glm::vec3(0.3, 0.3, 0.8)));
-	glUniform1i(ourTextureLoc, Texture::TEX_WATER);
-
-	glDrawArrays(GL_QUADS, 0, 4);
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 }
 
-// function to draw terrain
+// function to draw the resident terrain chunks, each at the level of detail of its distance to the camera
 void drawTerrain(void) {
-	glBindVertexArray(VAO[Background::BG_TERRAIN]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO[Background::BG_TERRAIN]);
-
-	unsigned int objLoc = glGetUniformLocation(program, "obj");
-	unsigned int modelLoc = glGetUniformLocation(program, "model");
-	unsigned int vColorLoc = glGetUniformLocation(program, "vColor");
-	unsigned int ourTextureLoc = glGetUniformLocation(program, "ourTexture");
-
-	object = Object::OBJ_GROUND;
-	glUniform1i(objLoc, object);
+	useObjectProgram(Object::OBJ_TERRAIN, groundLayer + 1);
 
 	model = glm::mat4(1.0f);
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(glm::vec3(0.8, 0.8, 0.8)));
-	glUniform1i(ourTextureLoc, groundTexture);
+	const glm::vec3 eye = eyePosition();
+
+	const float halfSize = (worldSize - 1) / 2.0f;
+	for (auto& entry : chunks) {
+		const terrainChunk& chunk = entry.second;
+		const float minX = chunk.chunkX * CHUNK_QUADS - halfSize;
+		const float minZ = chunk.chunkZ * CHUNK_QUADS - halfSize;
+		totalChunks++;
+		if (!boxInFrustum(glm::vec3(minX, chunk.minHeight, minZ), glm::vec3(minX + CHUNK_QUADS, chunk.maxHeight, minZ + CHUNK_QUADS))) {
+			culledChunks++;
+			continue;
+		}
+
+		// vertices of this level blend into the next level before the chunk switches to it
+		const int level = chunkLod(chunk, eye);
+		setObjectUniforms(model, glm::vec3(0.8, 0.8, 0.8), glm::vec4(LOD_DISTANCE, LOD_MORPH_RATIO, 0.0f, 0.0f));
 
-	glDrawArrays(GL_QUADS, 0, VERTICES);
+		glBindVertexArray(chunk.VAO);
+		glDrawElements(GL_TRIANGLE_STRIP, lodIndexCount[level], GL_UNSIGNED_SHORT, (void*)(lodIndexOffset[level] * sizeof(GLushort)));
+	}
 }
 
 // function to draw sky
 void drawSky(void) {
+	// the quad keeps SKY_DISTANCE in front of the camera along -Z
+	const glm::vec3 eye = eyePosition();
+	const glm::vec3 offset = glm::vec3(eye.x, 0.0f, eye.z - SKY_DISTANCE / 2.0f);
+
+	totalObjects++;
+	if (!boxInFrustum(offset + glm::vec3(-1.0f, -1.0f / 15.0f, -0.5f) * SKY_DISTANCE, offset + glm::vec3(1.0f, 1.0f / 1.50f, -0.5f) * SKY_DISTANCE)) {
+		culledObjects++;
+		return;
+	}
+
 	glBindVertexArray(VAO[Background::BG_SKY]);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO[Background::BG_SKY]);
 
-	unsigned int objLoc = glGetUniformLocation(program, "obj");
-	unsigned int modelLoc = glGetUniformLocation(program, "model");
-	unsigned int vColorLoc = glGetUniformLocation(program, "vColor");
-	unsigned int ourTextureLoc = glGetUniformLocation(program, "ourTexture");
-
-	object = Object::OBJ_SKY;
-	glUniform1i(objLoc, object);
+	useObjectProgram(Object::OBJ_SKY);
 
-	model = glm::mat4(1.0f);
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(skyColor));
-	glUniform1i(ourTextureLoc, Texture::TEX_SKY);
+	model = glm::translate(glm::mat4(1.0f), offset);
+	model = glm::scale(model, glm::vec3(SKY_DISTANCE));
+	setObjectUniforms(model, skyColor);
 
-	glDrawArrays(GL_QUADS, 0, 4);
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 }
 
-// function to draw tree
-void drawTree(float x, float y, float z) {
-	glm::vec3 treeColor = glm::vec3(0.1, 0.9, 0.2);
-	glm::vec3 woodColor = glm::vec3(0.7, 0.6, 0.5);
-
-	glBindVertexArray(VAO[GLUT_OBJ]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO[GLUT_OBJ]);
-
-	unsigned int objLoc = glGetUniformLocation(program, "obj");
-	unsigned int modelLoc = glGetUniformLocation(program, "model");
-	unsigned int vColorLoc = glGetUniformLocation(program, "vColor");
-
-	object = Object::OBJ_GLUT;
-	glUniform1i(objLoc, object);
-
-	model = glm::mat4(1.0f);
-	model = glm::translate(model, glm::vec3(x, y, z));
-	model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0, 0.0, 0.0));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(woodColor));
-	glutSolidCylinder(0.3, 2.5, 50, 50);
+// function to draw all visible trees - the mesh levels are queued as parts for "drawParts", the impostors are
+// drawn instanced
+void drawTrees(void) {
+	// sort the instances whose bounding sphere touches the view frustum by level of detail
+	for (int level = 0; level < treeLodCount; level++)
+		lodTrees[level].clear();
+	totalObjects += (int)treeInstances.size();
+	for (size_t i = 0; i < treeInstances.size(); i++) {
+		const glm::vec4& tree = treeInstances[i];
+		const glm::vec3 center = glm::vec3(tree) + TREE_BOUNDS_CENTER * tree.w;
+		if (!sphereInFrustum(center, TREE_BOUNDS_RADIUS * tree.w)) {
+			culledObjects++;
+			continue;
+		}
+		treeLevels[i] = (unsigned char)selectLod(treeLevels[i], projectedSize(center, TREE_BOUNDS_RADIUS * tree.w), TREE_LOD_PIXELS, treeLodCount);
+		lodTrees[treeLevels[i]].push_back(tree);
+	}
 
-	model = glm::mat4(1.0f);
-	model = glm::translate(model, glm::vec3(x, y, z));
-	model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0, 0.0, 0.0));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(treeColor));
-	glutSolidCone(1.6, 1.5, 50, 50);
+	// tree colors are baked into the meshes, the part color leaves them as they are
+	for (int level = 0; level < TREE_MESH_LODS; level++) {
+		for (const glm::vec4& tree : lodTrees[level]) {
+			const glm::mat4 treeModel = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(tree)), glm::vec3(tree.w));
+			queuePart(treeMeshes[level], treeModel, glm::vec3(1.0f));
+		}
+	}
 
-	model = glm::mat4(1.0f);
-	model = glm::translate(model, glm::vec3(x, y + 1.0f, z));
-	model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0, 0.0, 0.0));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(treeColor));
-	glutSolidCone(1.4, 1.5, 50, 50);
+	if (treeLodCount < TREE_LODS || lodTrees[TREE_MESH_LODS].empty())
+		return;
+	const std::vector<glm::vec4>& impostors = lodTrees[TREE_MESH_LODS];
+	glBindBuffer(GL_ARRAY_BUFFER, treeInstanceVBO);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, impostors.size() * sizeof(glm::vec4), impostors.data());
+	glBindVertexArray(VAO[TREE_OBJ]);
 
+	useObjectProgram(Object::OBJ_IMPOSTOR);
 	model = glm::mat4(1.0f);
-	model = glm::translate(model, glm::vec3(x, y + 2.0f, z));
-	model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0, 0.0, 0.0));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(treeColor));
-	glutSolidCone(1.2, 1.5, 50, 50);
+	setObjectUniforms(model, glm::vec3(1.0, 1.0, 1.0),
+		glm::vec4(TREE_BOUNDS_CENTER.y, IMPOSTOR_HALF_SIZE.x, IMPOSTOR_HALF_SIZE.y, (float)IMPOSTOR_VIEWS));
+	glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, (GLsizei)impostors.size());
 }
 
-// function to draw duck
-void drawDuck(float x, float y, float z, float rotation, float dir) {
+// function to queue the parts of a duck
+void drawDuck(float x, float y, float z, float rotation, float dir, bool detail) {
+	const int cube = cachedMesh(Shape::SHAPE_CUBE, 1.0f, 1.0f, 0);
 	glm::vec3 bodyColor = glm::vec3(0.9, 1.0, 0.3);
 	glm::vec3 wingColor = glm::vec3(0.8, 0.9, 0.2);
 	glm::vec3 eyeColor = glm::vec3(0.0, 0.0, 0.0);
 	glm::vec3 beakColor = glm::vec3(0.5, 0.2, 0.0);
 
-	glBindVertexArray(VAO[GLUT_OBJ]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO[GLUT_OBJ]);
-
-	unsigned int objLoc = glGetUniformLocation(program, "obj");
-	unsigned int modelLoc = glGetUniformLocation(program, "model");
-	unsigned int vColorLoc = glGetUniformLocation(program, "vColor");
-
-	object = Object::OBJ_GLUT;
-	glUniform1i(objLoc, object);
-
 	// body
 	const GLfloat w1 = 2.0f;
 	const GLfloat h1 = 1.2f;
@@ -635,9 +3004,7 @@ void drawDuck(float x, float y, float z, float rotation, float dir) {
 	model = glm::translate(model, glm::vec3(x, y + h1 / 2, z));
 	model = glm::rotate(model, glm::radians(rotation), glm::vec3(0.0, 1.0, 0.0));
 	model = glm::scale(model, glm::vec3(w1, h1, d1));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(bodyColor));
-	glutSolidCube(1.0);
+	queuePart(cube, model, bodyColor);
 
 	// wings
 	const GLfloat w2 = 1.2f;
@@ -647,9 +3014,7 @@ void drawDuck(float x, float y, float z, float rotation, float dir) {
 	model = glm::translate(model, glm::vec3(x, y + h1 / 2, z));
 	model = glm::rotate(model, glm::radians(rotation), glm::vec3(0.0, 1.0, 0.0));
 	model = glm::scale(model, glm::vec3(w2, h2, d2));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(wingColor));
-	glutSolidCube(1.0);
+	queuePart(cube, model, wingColor);
 
 	// head
 	const GLfloat w3 = 1.0f;
@@ -659,9 +3024,10 @@ void drawDuck(float x, float y, float z, float rotation, float dir) {
 	model = glm::translate(model, glm::vec3(x + dir * (w1 / 4), y + h1 + h3 / 4, z));
 	model = glm::rotate(model, glm::radians(rotation), glm::vec3(0.0, 1.0, 0.0));
 	model = glm::scale(model, glm::vec3(w3, h3, d3));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(bodyColor));
-	glutSolidCube(1.0);
+	queuePart(cube, model, bodyColor);
+
+	if (!detail)
+		return;
 
 	// eyes
 	const GLfloat w4 = 0.25f;
@@ -671,9 +3037,7 @@ void drawDuck(float x, float y, float z, float rotation, float dir) {
 	model = glm::translate(model, glm::vec3(x + dir * (w1 / 3), y + h1 + h3 / 2, z));
 	model = glm::rotate(model, glm::radians(rotation), glm::vec3(0.0, 1.0, 0.0));
 	model = glm::scale(model, glm::vec3(w4, h4, d4));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(eyeColor));
-	glutSolidCube(1.0);
+	queuePart(cube, model, eyeColor);
 
 	// beak
 	const GLfloat w5 = 0.5f;
@@ -683,27 +3047,16 @@ void drawDuck(float x, float y, float z, float rotation, float dir) {
 	model = glm::translate(model, glm::vec3(x + dir * (w1 / 1.75), y + h1 + h3 / 5, z));
 	model = glm::rotate(model, glm::radians(rotation), glm::vec3(0.0, 1.0, 0.0));
 	model = glm::scale(model, glm::vec3(w5, h5, d5));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(beakColor));
-	glutSolidCube(1.0);
+	queuePart(cube, model, beakColor);
 }
 
-// function to draw goat
-void drawGoat(float x, float y, float z, float dir) {
+// function to queue the parts of a goat
+void drawGoat(float x, float y, float z, float dir, bool detail) {
+	const int cube = cachedMesh(Shape::SHAPE_CUBE, 1.0f, 1.0f, 0);
 	glm::vec3 furColor = glm::vec3(0.9, 0.9, 0.9);
 	glm::vec3 hornColor = glm::vec3(0.3, 0.3, 0.3);
 	glm::vec3 eyeColor = glm::vec3(0.0, 0.0, 0.0);
 
-	glBindVertexArray(VAO[GLUT_OBJ]);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO[GLUT_OBJ]);
-
-	unsigned int objLoc = glGetUniformLocation(program, "obj");
-	unsigned int modelLoc = glGetUniformLocation(program, "model");
-	unsigned int vColorLoc = glGetUniformLocation(program, "vColor");
-
-	object = Object::OBJ_GLUT;
-	glUniform1i(objLoc, object);
-
 	// body
 	const GLfloat w1 = 3.0f;
 	const GLfloat h1 = 1.5f;
@@ -711,9 +3064,7 @@ void drawGoat(float x, float y, float z, float dir) {
 	model = glm::mat4(1.0f);
 	model = glm::translate(model, glm::vec3(x, y + h1, z));
 	model = glm::scale(model, glm::vec3(w1, h1, d1));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(furColor));
-	glutSolidCube(1.0);
+	queuePart(cube, model, furColor);
 
 	// legs
 	for (int i = 0; i < 4; i++) {
@@ -726,9 +3077,7 @@ void drawGoat(float x, float y, float z, float dir) {
 		if (i == 2) model = glm::translate(model, glm::vec3(x + 1.2, y + h2 / 2, z - 0.5));
 		if (i == 3) model = glm::translate(model, glm::vec3(x + 1.2, y + h2 / 2, z + 0.5));
 		model = glm::scale(model, glm::vec3(w2, h2, d2));
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		glUniform3fv(vColorLoc, 1, glm::value_ptr(furColor));
-		glutSolidCube(1.0);
+		queuePart(cube, model, furColor);
 	}
 
 	// head
@@ -739,9 +3088,10 @@ void drawGoat(float x, float y, float z, float dir) {
 	model = glm::translate(model, glm::vec3(x + dir * (w1 / 2), y + h1 + h3 / 2, z));
 	model = glm::rotate(model, glm::radians(dir * 45.0f), glm::vec3(0.0, 0.0, 1.0));
 	model = glm::scale(model, glm::vec3(w3, h3, d3));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(furColor));
-	glutSolidCube(1.0);
+	queuePart(cube, model, furColor);
+
+	if (!detail)
+		return;
 
 	// eyes
 	const GLfloat w4 = 0.15f;
@@ -751,9 +3101,7 @@ void drawGoat(float x, float y, float z, float dir) {
 	model = glm::translate(model, glm::vec3(x + dir * (w1 / 2.25), y + h1 + h3 / 1.25f, z));
 	model = glm::rotate(model, glm::radians(dir * 45.0f), glm::vec3(0.0, 0.0, 1.0));
 	model = glm::scale(model, glm::vec3(w4, h4, d4));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform3fv(vColorLoc, 1, glm::value_ptr(eyeColor));
-	glutSolidCube(1.0);
+	queuePart(cube, model, eyeColor);
 
 	// horns
 	const GLfloat w5 = 0.2f;
@@ -764,9 +3112,7 @@ void drawGoat(float x, float y, float z, float dir) {
 		if (i == 0) model = glm::translate(model, glm::vec3(x + dir * (w1 / 2.5), y + h1 + h3, z + 0.25f));
 		if (i == 1) model = glm::translate(model, glm::vec3(x + dir * (w1 / 2.5), y + h1 + h3, z - 0.25f));
 		model = glm::scale(model, glm::vec3(w5, h5, d5));
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		glUniform3fv(vColorLoc, 1, glm::value_ptr(hornColor));
-		glutSolidCube(1.0);
+		queuePart(cube, model, hornColor);
 	}
 }
 
@@ -789,17 +3135,31 @@ void drawMenu(void) {
 	glLoadIdentity();
 	gluOrtho2D(0.0, 1280.0, 0.0, 720.0);
 
-	startTextLoc = 240;
+	startTextLoc = 300;
 	curTextLoc = startTextLoc;
 
 	sprintf(curFPSstr, "%.2f", curFPS);
 	char curFPSdisplay[50] = "Current FPS   : ";
 	strcat(curFPSdisplay, curFPSstr);
 
+	char framePacingDisplay[80];
+	sprintf(framePacingDisplay, "Frame pacing  : %s%s%s",
+		targetFrameRate > 0 ? (std::to_string(targetFrameRate) + " fps").c_str() : "unlimited",
+		useVsync ? ", vsync" : "",
+		useOnDemandRedraw ? (", on demand, " + std::to_string(1000 / ON_DEMAND_AMBIENT_MS) + " fps without input").c_str() : "");
+
+	char culledObjectsDisplay[50], culledChunksDisplay[50];
+	sprintf(culledObjectsDisplay, "Culled objects: %d / %d", culledObjects, totalObjects);
+	sprintf(culledChunksDisplay, "Culled chunks : %d / %d", culledChunks, totalChunks);
+
 	if (showMenu) {
 		drawText(30, textLoc(), (char*)curFPSdisplay);
+		drawText(30, textLoc(), framePacingDisplay);
+		drawText(30, textLoc(), culledObjectsDisplay);
+		drawText(30, textLoc(), culledChunksDisplay);
 		drawText(30, textLoc(), (char*)"Arrow Key     : Move camera");
 		drawText(30, textLoc(), (char*)"PG UP / PG DN : Move camera Up, Down");
+		drawText(30, textLoc(), (char*)"0             : Blend ground by height, slope");
 		drawText(30, textLoc(), (char*)"1 2 3 4       : Change ground texture");
 		drawText(30, textLoc(), (char*)(
 			useSuperman
@@ -820,14 +3180,10 @@ void drawMenu(void) {
 		drawText(30, textLoc(), (char*)"Q             : Quit");
 	}
 	drawText(30, 30, (char*)"H             : Help Menu");
-	glUseProgram(program);
 }
 
-// function to display
-void display(void) {
-	renderCounter++;
-
-	glUseProgram(program);
+// function to render the 3D scene into the current framebuffer
+void renderScene(void) {
 	glClear(GL_COLOR_BUFFER_BIT);
 	glClear(GL_DEPTH_BUFFER_BIT);
 
@@ -845,29 +3201,26 @@ void display(void) {
 			glm::vec3(dirX, dirY, dirZ),
 			glm::vec3(0.0, 1.0, 0.0));
 
-	// pass camera to fragment shader for light calculation
-	unsigned int viewLoc = glGetUniformLocation(program, "view");
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+	// swap in edited shaders that finished compiling
+	pollShaderReload();
 
-	// pass camera position to fragment shader for light calculation
-	unsigned int viewPosLoc = glGetUniformLocation(program, "viewPos");
-	glUniform3fv(viewPosLoc, 1, glm::value_ptr(glm::vec3(camX, camY, camZ)));
+	// camera and light for this frame, in a fresh region of the uniform ring
+	nextUniformRegion();
+	setFrameUniforms();
 
-	// pass light position vector to fragment shader for light calculation
-	unsigned int lightPosLoc = glGetUniformLocation(program, "sunlightPos");
-	glUniform3fv(lightPosLoc, 1, glm::value_ptr(sunlightPos));
+	// clipping planes for culling, counters are shown in the menu
+	extractFrustum(proj * view);
 
-	// pass light color to fragment shader for light calculation
-	unsigned int lightColorLoc = glGetUniformLocation(program, "sunlightColor");
-	glUniform3fv(lightColorLoc, 1, glm::value_ptr(sunlightColor));
+	// pixels per world unit at distance 1 for the level of detail selection
+	lodPixelScale = proj[1][1] * glutGet(GLUT_WINDOW_HEIGHT) / 2.0f;
+	culledObjects = totalObjects = 0;
+	culledChunks = totalChunks = 0;
 
-	// pass useFog to fragment shader to determine usage of fog
-	unsigned int useFogLoc = glGetUniformLocation(program, "useFog");
-	glUniform1i(useFogLoc, useFog);
+	// swap in textures that finished loading
+	pollTextures();
 
-	// pass useTexture to fragment shader to determine usage of textures
-	unsigned int useTextureLoc = glGetUniformLocation(program, "useTexture");
-	glUniform1i(useTextureLoc, useTexture);
+	// build terrain chunks the camera moved close to
+	streamChunks(eyePosition(), MAX_CHUNK_BUILDS_PER_FRAME);
 
 	// draw background
 	drawWater();
@@ -875,24 +3228,190 @@ void display(void) {
 	drawSky();
 
 	// draw trees
-	for (int i = 0; i < NUM_OF_TREES; i++)
-		drawTree(treesCoord[i][0], treesCoord[i][1], treesCoord[i][2]);
+	drawTrees();
+
+	// draw animals, skipping those outside the view frustum
+	const size_t animalCount = animals.x.size();
+	totalObjects += (int)animalCount;
+	for (size_t i = 0; i < animalCount; i++) {
+		const float x = glm::mix(animals.previousX[i], animals.x[i], simAlpha);
+		const glm::vec3 center = glm::vec3(x, animals.y[i] + animals.boundsHeight[i], animals.z[i]);
+		const float radius = animals.boundsRadius[i];
+		if (!sphereInFrustum(center, radius)) {
+			culledObjects++;
+			continue;
+		}
+		animals.level[i] = (unsigned char)selectLod(animals.level[i], projectedSize(center, radius), ANIMAL_DETAIL_PIXELS, ANIMAL_LODS);
+		const bool detail = animals.level[i] == 0;
+		if (animals.species[i] == Species::SPECIES_DUCK) {
+			const float rotation = glm::mix(animals.previousRotation[i], animals.rotation[i], simAlpha);
+			drawDuck(x, animals.y[i], animals.z[i], rotation, animals.heading[i], detail);
+		}
+		else
+			drawGoat(x, animals.y[i], animals.z[i], animals.heading[i], detail);
+	}
+	drawParts();
+}
+
+// function to display
+void display(void) {
+	renderCounter++;
+
+	// catch the simulation up with the clock
+	advanceSimulation();
 
-	// draw animals
-	for (int i = 0; i < NUM_OF_DUCKS; i++)
-		drawDuck(ducksCoord[i][0], ducksCoord[i][1], ducksCoord[i][2], ducksCoord[i][3], ducksDirection[i]);
-	for (int i = 0; i < NUM_OF_GOATS; i++)
-		drawGoat(goatsCoord[i][0], goatsCoord[i][1], goatsCoord[i][2], goatsDirection[i]);
+	renderScene();
 
 	// draw menu
 	drawMenu();
 
 	glutSwapBuffers();
+
+	updateFPS();
+}
+
+// function to place the Superman camera at angle "circle" of its orbit
+void setSupermanCamera(float circle) {
+	supermanCamX = (cos(circle) * WORLD_SIZE / 3.0f);
+	supermanDirX = (cos(circle) * WORLD_SIZE / 4.0f);
+
+	supermanCamZ = (sin(circle) * WORLD_SIZE / 3.0f);
+	supermanDirZ = (sin(circle) * WORLD_SIZE / 4.0f);
+}
+
+// function to place the sun at "x", it is brightest above the middle of the scene
+void setSunlight(float x) {
+	float ratio = 1.0f - abs(x / WORLD_SIZE);
+	float newSunlightColor = 10.0f * ratio;
+	sunlightPos[0] = x;
+	sunlightColor = glm::vec3(newSunlightColor, newSunlightColor, newSunlightColor);
+}
+
+// function to place camera on the fixed benchmark path
+void setBenchmarkCamera(int frame, int frames) {
+	const float t = (float)frame / (float)frames;
+
+	// first half: walk from the shore towards the middle of the terrain
+	// second half: one full Superman orbit around the scene
+	if (t < 0.5f) {
+		useSuperman = false;
+		camX = 0.0f;
+		camY = MAX_HEIGHT * 1.0f;
+		camZ = WORLD_SIZE / 2.0f * (1.0f - t * 2.0f);
+		dirX = 0.0f;
+		dirY = MAX_HEIGHT / 2.0f;
+		dirZ = camZ - WORLD_SIZE / 2.0f;
+	}
+	else {
+		useSuperman = true;
+		supermanCircle = (t - 0.5f) * 2.0f * 2.0f * 3.142f;
+		setSupermanCamera(supermanCircle);
+	}
+}
+
+// function to print min / mean / percentiles and a histogram of frame times (ms)
+void printBenchmarkStats(const char* name, std::vector<double> samples) {
+	if (samples.empty())
+		return;
+	std::sort(samples.begin(), samples.end());
+
+	// nearest-rank percentile
+	auto percentile = [&samples](double p) {
+		size_t rank = (size_t)(p / 100.0 * samples.size() + 0.5);
+		rank = rank < 1 ? 1 : rank > samples.size() ? samples.size() : rank;
+		return samples[rank - 1];
+	};
+
+	double sum = 0.0;
+	for (double sample : samples)
+		sum += sample;
+
+	printf("%s time (ms): min %.3f  mean %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n",
+		name, samples.front(), sum / samples.size(),
+		percentile(50.0), percentile(95.0), percentile(99.0), samples.back());
+
+	// histogram with fixed number of equal-width buckets between min and max
+	const int BUCKETS = 10;
+	const int BAR_WIDTH = 50;
+	int counts[BUCKETS] = { 0 };
+	const double range = samples.back() - samples.front();
+	for (double sample : samples) {
+		int bucket = range > 0.0 ? (int)((sample - samples.front()) / range * BUCKETS) : 0;
+		counts[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+	}
+	const int maxCount = *std::max_element(counts, counts + BUCKETS);
+	for (int i = 0; i < BUCKETS; i++) {
+		const double lower = samples.front() + range * i / BUCKETS;
+		printf("  %9.3f | %-*s %d\n", lower, BAR_WIDTH,
+			std::string(counts[i] * BAR_WIDTH / maxCount, '#').c_str(), counts[i]);
+	}
+}
+
+// function to render a fixed number of frames offscreen and report frame times
+void runBenchmark(int frames) {
+	// every measured frame should draw the final textures, not the placeholders
+	while (!pollTextures())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	// offscreen render target, so the result does not depend on window size or vsync
+	glGenFramebuffers(1, &benchmarkFBO);
+	glGenRenderbuffers(1, &benchmarkColorRBO);
+	glGenRenderbuffers(1, &benchmarkDepthRBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, benchmarkFBO);
+	glBindRenderbuffer(GL_RENDERBUFFER, benchmarkColorRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, benchmarkColorRBO);
+	glBindRenderbuffer(GL_RENDERBUFFER, benchmarkDepthRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, benchmarkDepthRBO);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "Failed to create benchmark framebuffer" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	glViewport(0, 0, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+
+	// one timer query per recorded frame, read back after the run to avoid stalls
+	std::vector<GLuint> queries(frames);
+	glGenQueries(frames, queries.data());
+	std::vector<double> cpuTimes;
+	std::vector<double> gpuTimes;
+
+	for (int frame = -BENCHMARK_WARMUP; frame < frames; frame++) {
+		setBenchmarkCamera(frame < 0 ? 0 : frame, frames);
+
+		const auto start = std::chrono::steady_clock::now();
+		if (frame >= 0) glBeginQuery(GL_TIME_ELAPSED, queries[frame]);
+		renderScene();
+		if (frame >= 0) glEndQuery(GL_TIME_ELAPSED);
+		glFlush();
+		const auto end = std::chrono::steady_clock::now();
+
+		if (frame >= 0)
+			cpuTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	glFinish();
+
+	for (int i = 0; i < frames; i++) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+		gpuTimes.push_back(elapsed / 1.0e6);
+	}
+	glDeleteQueries(frames, queries.data());
+
+	printf("Benchmark: %d frames at %dx%d (%s)\n", frames, BENCHMARK_WIDTH, BENCHMARK_HEIGHT,
+		(const char*)glGetString(GL_RENDERER));
+	printBenchmarkStats("CPU", cpuTimes);
+	printBenchmarkStats("GPU", gpuTimes);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &benchmarkFBO);
+	glDeleteRenderbuffers(1, &benchmarkColorRBO);
+	glDeleteRenderbuffers(1, &benchmarkDepthRBO);
 }
 
-// function to update
-void update(int n) {
-	// alternate water texture coordinate to create the illusion of motion
+// function to alternate the water texture coordinates to create the illusion of motion
+void updateWater(void) {
 	if (ripple == 0) {
 		water[6] = 0.0f;
 		water[7] = 0.0f;
@@ -937,20 +3456,11 @@ void update(int n) {
 	glBindVertexArray(VAO[Background::BG_WATER]);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO[Background::BG_WATER]);
 	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(water), water);
-	ripple = (++ripple) % 4;
-
-	// change sunlight position and color
-	float newSunlightX = sunlightPos[0] - 1.0f;
-	float ratio = 1.0f - abs(newSunlightX / WORLD_SIZE);
-	float newSunlightColor = 10.0f * ratio;
-	sunlightPos[0] = newSunlightX <= -WORLD_SIZE ? WORLD_SIZE : newSunlightX;
-	sunlightColor = glm::vec3(newSunlightColor, newSunlightColor, newSunlightColor);
-
-	glutTimerFunc(500, update, 0);
+	ripple = (ripple + 1) % 4;
 }
 
 // function to calculate FPS
-void updateFPS(int n) {
+void updateFPS(void) {
 	s_time = glutGet(GLUT_ELAPSED_TIME);
 
 	if (s_time - e_time >= 1000) {
@@ -958,91 +3468,183 @@ void updateFPS(int n) {
 		e_time = s_time;
 		renderCounter = 0;
 	}
-	glutTimerFunc(5, updateFPS, 0);
 }
 
-// function to update animals
-void updateAnimals(int n) {
-	// change duck swim direction
-	for (int i = 0; i < NUM_OF_DUCKS; i++) {
-		ducksCoord[i][0] += ducksDirection[i] > 0
-			? +1.0f
-			: -1.0f;
-		ducksCoord[i][3] = ducksCoord[i][3] > 0 ? -5.0f : +5.0f;
-
-		if (ducksCoord[i][0] > WORLD_SIZE / 3 || ducksCoord[i][0] < 0)
-			ducksDirection[i] = ducksDirection[i] > 0 ? -1 : +1;
+// function to move the animals by one simulation step
+void updateAnimals(void) {
+	// every species in one pass per step, the loops are branch-free so they vectorize
+	const int count = (int)animals.x.size();
+	float* x = animals.x.data();
+	float* heading = animals.heading.data();
+	float* rotation = animals.rotation.data();
+	const float* speed = animals.speed.data();
+	const float* wobble = animals.wobble.data();
+	const float* minX = animals.minX.data();
+	const float* maxX = animals.maxX.data();
+	animals.previousX = animals.x;
+	animals.previousRotation = animals.rotation;
+
+	// triangle wave from -1 to +1 and back once per WOBBLE_PERIOD
+	const float phase = (float)fmod(simTime / WOBBLE_PERIOD, 1.0);
+	const float wave = 4.0f * fabs(phase - 0.5f) - 1.0f;
+
+	// walk, and wobble between -wobble and +wobble
+	for (int i = 0; i < count; i++) {
+		x[i] += heading[i] * speed[i] * SIM_STEP;
+		rotation[i] = wobble[i] * wave;
 	}
 
-	// change goat walk direction
-	for (int i = 0; i < NUM_OF_DUCKS; i++) {
-		goatsCoord[i][0] += goatsDirection[i] > 0
-			? +1.0f
-			: -1.0f;
+	// turn around at the ends of the walk
+	for (int i = 0; i < count; i++)
+		heading[i] = x[i] > maxX[i] || x[i] < minX[i] ? -heading[i] : heading[i];
+}
+
+// function to advance the water, sun, animals and Superman camera by SIM_STEP
+void simulationStep(void) {
+	simSteps++;
+	simTime += SIM_STEP;
+
+	if (simSteps % (RIPPLE_INTERVAL_MS / SIM_STEP_MS) == 0)
+		updateWater();
+
+	// the sun starts over at the far side once it has crossed the scene
+	previousSunlightX = sunlightX;
+	sunlightX -= SUNLIGHT_SPEED * SIM_STEP;
+	if (sunlightX <= -WORLD_SIZE)
+		previousSunlightX = sunlightX = WORLD_SIZE;
+
+	updateAnimals();
+
+	previousSupermanCircle = supermanCircle;
+	if (useSuperman)
+		supermanCircle += SUPERMAN_SPEED * SIM_STEP;
+}
 
-		if (goatsCoord[i][0] > -WORLD_SIZE / 5 || goatsCoord[i][0] < -WORLD_SIZE / 3)
-			goatsDirection[i] = goatsDirection[i] > 0 ? -1 : +1;
+// function to run the simulation steps that fell due since the last frame and blend the drawn state
+void advanceSimulation(void) {
+	const int now = glutGet(GLUT_ELAPSED_TIME);
+	if (lastSimTime < 0)
+		lastSimTime = now;
+	simAccumulator = std::min(simAccumulator + now - lastSimTime, MAX_SIM_CATCH_UP_MS);
+	lastSimTime = now;
+
+	while (simAccumulator >= SIM_STEP_MS) {
+		simulationStep();
+		simAccumulator -= SIM_STEP_MS;
 	}
 
-	glutTimerFunc(400, updateAnimals, 0);
+	// state between the last two steps
+	simAlpha = simAccumulator / (float)SIM_STEP_MS;
+	setSunlight(glm::mix(previousSunlightX, sunlightX, simAlpha));
+	if (useSuperman)
+		setSupermanCamera(glm::mix(previousSupermanCircle, supermanCircle, simAlpha));
 }
 
-// function to update Superman position
-void updateSuperman(int n) {
-	if (useSuperman) {
-		supermanCircle += increment;
+// function to ask the driver to wait for "interval" vertical blanks per swap, false if it cannot
+bool setSwapInterval(int interval) {
+#if defined(_WIN32)
+	typedef BOOL(WINAPI* swapIntervalProc)(int);
+	swapIntervalProc swapInterval = (swapIntervalProc)wglGetProcAddress("wglSwapIntervalEXT");
+	return swapInterval != NULL && swapInterval(interval) == TRUE;
+#else
+	// the Mesa entry point takes 0, the SGI one only turns vsync on
+	typedef int (*swapIntervalMesaProc)(unsigned int);
+	typedef int (*swapIntervalSGIProc)(int);
+	swapIntervalMesaProc swapIntervalMesa = (swapIntervalMesaProc)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalMESA");
+	if (swapIntervalMesa != NULL)
+		return swapIntervalMesa((unsigned int)interval) == 0;
+	swapIntervalSGIProc swapIntervalSGI = (swapIntervalSGIProc)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalSGI");
+	return swapIntervalSGI != NULL && interval > 0 && swapIntervalSGI(interval) == 0;
+#endif
+}
+
+// function to set up vsync and the first frame deadline of the frame scheduler
+void initFramePacing(void) {
+	// without the extension the driver default applies and the scheduler paces the frames on its own
+	if (!setSwapInterval(useVsync ? 1 : 0))
+		useVsync = false;
+	nextFrameTime = std::chrono::steady_clock::now();
+}
+
+// function to ask the frame scheduler for a frame even in on-demand mode, and follow the simulation for a while
+void requestRedraw(void) {
+	redrawRequested = true;
+	lastInputTime = glutGet(GLUT_ELAPSED_TIME);
+}
 
-		supermanCamX = (cos(supermanCircle) * WORLD_SIZE / 3.0f);
-		supermanDirX = (cos(supermanCircle) * WORLD_SIZE / 4.0f);
+// function run by GLUT when no events are waiting - posts the next frame once it is due, otherwise sleeps
+void idle(void) {
+	const auto now = std::chrono::steady_clock::now();
+	if (now < nextFrameTime) {
+		std::this_thread::sleep_until(nextFrameTime);
+		return;
+	}
 
-		supermanCamZ = (sin(supermanCircle) * WORLD_SIZE / 3.0f);
-		supermanDirZ = (sin(supermanCircle) * WORLD_SIZE / 4.0f);
+	// on demand: nothing to draw until the next simulation step after input, or the next ambient frame
+	if (useOnDemandRedraw && !redrawRequested) {
+		const int elapsed = glutGet(GLUT_ELAPSED_TIME);
+		const bool active = useSuperman || elapsed - lastInputTime < ON_DEMAND_ACTIVE_MS;
+		const int untilFrame = (active ? SIM_STEP_MS - simAccumulator : ON_DEMAND_AMBIENT_MS) - (elapsed - lastSimTime);
+		if (lastSimTime >= 0 && untilFrame > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(std::min(untilFrame, SIM_STEP_MS)));
+			return;
+		}
 	}
 
-	glutTimerFunc(100, updateSuperman, 0);
+	// the next deadline follows the last one, a late frame (vsync, slow GPU) restarts the schedule from now
+	if (targetFrameRate > 0) {
+		const auto interval = std::chrono::microseconds(1000000 / targetFrameRate);
+		nextFrameTime = nextFrameTime + interval < now ? now + interval : nextFrameTime + interval;
+	}
+	redrawRequested = false;
+	glutPostRedisplay();
 }
 
 // function to detect special keys
 void specialKey(int key, int mouseX, int mouseY) {
+	const float halfSize = (worldSize - 1) / 2.0f;
+	const float step = glm::clamp((worldSize - 1) / 128.0f, 0.5f, CAMERA_MAX_STEP);
+	const float ground = cameraGround();
+
 	// change camera position and ensure camera always "points" toward the front
 	switch (key) {
 	case GLUT_KEY_LEFT:
-		if (camX >= -WORLD_SIZE / 10.0f) {
-			camX -= 0.5;
-			dirX -= 0.5;
+		if (camX >= -halfSize + step) {
+			camX -= step;
+			dirX -= step;
 		}
 		break;
 
 	case GLUT_KEY_RIGHT:
-		if (camX <= WORLD_SIZE / 10.0f) {
-			camX += 0.5;
-			dirX += 0.5;
+		if (camX <= halfSize - step) {
+			camX += step;
+			dirX += step;
 		}
 		break;
 
 	case GLUT_KEY_UP:
-		if (camZ >= 0.0f) {
-			camZ -= 0.5;
-			dirZ -= 0.5;
+		if (camZ >= -halfSize + step) {
+			camZ -= step;
+			dirZ -= step;
 		}
 		break;
 
 	case GLUT_KEY_DOWN:
-		if (camZ <= WORLD_SIZE / 2.0f) {
-			camZ += 0.5;
-			dirZ += 0.5;
+		if (camZ <= halfSize - step) {
+			camZ += step;
+			dirZ += step;
 		}
 		break;
 
 	case GLUT_KEY_PAGE_UP:
-		if (camY <= 10.0) {
+		if (camY - ground <= CAMERA_MAX_HEIGHT) {
 			camY += 0.5;
 			dirY += 0.5;
 		}
 		break;
 
 	case GLUT_KEY_PAGE_DOWN:
-		if (camY >= 2.0) {
+		if (camY - ground >= CAMERA_MIN_HEIGHT) {
 			camY -= 0.5;
 			dirY -= 0.5;
 		}
@@ -1059,22 +3661,31 @@ void specialKey(int key, int mouseX, int mouseY) {
 		break;
 	}
 
+	// the camera and its view direction rise and fall with the ground under it
+	const float rise = cameraGround() - ground;
+	camY += rise;
+	dirY += rise;
+
+	requestRedraw();
 }
 
 // function to detect keys
 void keyboardKey(unsigned char key, int mouseX, int mouseY) {
 	switch (key) {
+	case '0':
+		groundLayer = -1;
+		break;
 	case '1':
-		groundTexture = Texture::TEX_GRASS;
+		groundLayer = Texture::TEX_GRASS - Texture::TEX_GRASS;
 		break;
 	case '2':
-		groundTexture = Texture::TEX_FOREST;
+		groundLayer = Texture::TEX_FOREST - Texture::TEX_GRASS;
 		break;
 	case '3':
-		groundTexture = Texture::TEX_SAND;
+		groundLayer = Texture::TEX_SAND - Texture::TEX_GRASS;
 		break;
 	case '4':
-		groundTexture = Texture::TEX_EARTH;
+		groundLayer = Texture::TEX_EARTH - Texture::TEX_GRASS;
 		break;
 
 	case 'a':
@@ -1101,11 +3712,74 @@ void keyboardKey(unsigned char key, int mouseX, int mouseY) {
 	default:
 		break;
 	}
+
+	requestRedraw();
 }
 
 // function to run main program
 int main(int argc, char** argv) {
 	glutInit(&argc, argv);
+
+	// command line options
+	// --benchmark N : render N frames offscreen on a fixed camera path, print frame times and exit
+	// --trees N     : scatter N more trees over the terrain
+	// --animals N   : scatter N more animals, ducks on water and goats on land
+	// --world-size N: terrain size in height samples per side, 2^n + 1 and at least CHUNK_SIZE
+	// --seed N      : seed of the terrain generator, the same seed always gives the same terrain
+	// --fps N       : frames per second to pace the display to, 0 redraws as fast as possible (default 60)
+	// --no-vsync    : do not wait for the vertical blank when swapping
+	// --on-demand   : redraw on input and follow the animation for a second after it, otherwise draw the ambient
+	//                 motion at 5 fps
+	// --transcode-textures: compress every texture into the texture cache and exit
+	bool transcodeOnly = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc) {
+			useBenchmark = true;
+			benchmarkFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--trees") == 0 && i + 1 < argc) {
+			extraTrees = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--animals") == 0 && i + 1 < argc) {
+			extraAnimals = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--world-size") == 0 && i + 1 < argc) {
+			worldSize = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			terrainSeed = (unsigned int)strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+			targetFrameRate = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-vsync") == 0) {
+			useVsync = false;
+		}
+		else if (strcmp(argv[i], "--on-demand") == 0) {
+			useOnDemandRedraw = true;
+		}
+		else if (strcmp(argv[i], "--transcode-textures") == 0) {
+			transcodeOnly = true;
+		}
+	}
+	if (worldSize - 1 < CHUNK_QUADS || ((worldSize - 1) & (worldSize - 2)) != 0) {
+		std::cout << "World size must be 2^n + 1 and at least " << CHUNK_SIZE << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (useBenchmark && benchmarkFrames <= 0) {
+		std::cout << "Benchmark needs a positive number of frames" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (transcodeOnly) {
+		for (int i = 0; i < TEXTURES; i++) {
+			if (!transcodeTexture(textureFiles[i], isGroundTexture(i) ? GROUND_LAYER_SIZE : 0)) {
+				std::cout << "Failed to transcode texture - " << textureFiles[i] << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		return EXIT_SUCCESS;
+	}
+
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH | GLUT_MULTISAMPLE);
 	glutInitWindowSize(1280, 720);
 	glutInitWindowPosition(0, 0);
@@ -1114,20 +3788,22 @@ int main(int argc, char** argv) {
 
 	init();
 
-	// display
+	if (useBenchmark) {
+		// the window is only needed for the GL context, it is never mapped
+		glutHideWindow();
+		runBenchmark(benchmarkFrames);
+		return 0;
+	}
+
+	// display - GLUT calls display for window events, the frame scheduler posts every other frame
+	initFramePacing();
 	glutDisplayFunc(display);
-	glutIdleFunc(display);
+	glutIdleFunc(idle);
 
 	// handle keyboard and special keys
 	glutSpecialFunc(specialKey);
 	glutKeyboardFunc(keyboardKey);
 
-	// update render
-	glutTimerFunc(500, update, 0);
-	glutTimerFunc(5, updateFPS, 0);
-	glutTimerFunc(400, updateAnimals, 0);
-	glutTimerFunc(100, updateSuperman, 0);
-
 	glutMainLoop();
 
 	return 0;
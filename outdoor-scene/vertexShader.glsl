@@ -2,40 +2,80 @@
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texCoord;
+layout (location = 3) in vec3 color;
+layout (location = 4) in vec4 instance;
+layout (location = 5) in vec2 morph;
+layout (location = 6) in mat4 partModel;
+layout (location = 10) in vec4 partColor;
 
 out vec3 vNormal;
 out vec3 vPos;
 out vec2 vTexCoord;
-out float textureFlag;
-out float sunlightEffect;
 out vec4 viewSpace;
+out vec3 vertexColor;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
-uniform int obj;
+// OBJ, USE_FOG and USE_TEXTURE select the variant, they are defined by the program loader
+// uniform blocks - the same declarations as in the fragment shader
+layout (std140) uniform FrameUniforms {
+	mat4 view;
+	mat4 proj;
+	vec4 viewPos;
+	vec4 sunlightPos;
+	vec4 sunlightColor;
+	vec4 eyePos;
+	vec4 fogSplat;		// fog start, fog end, splat map scale, splat map offset
+};
+layout (std140) uniform ObjectUniforms {
+	mat4 model;
+	vec4 vColor;
+	vec4 params;		// terrain: level of detail distance, morph ratio
+						// impostor: bounds center height, half width, half height, views
+};
 
 void main() {
-	gl_Position = proj * view * model * vec4(pos, 1.0);
-	vPos = vec3(model * vec4(pos, 1.0));
-	vNormal = vec3(model * vec4(normal, 0.0));
-	viewSpace = view * model * vec4(pos, 1.0);
-	
-	// water and terrain
-	if (obj == 1) {
-		textureFlag = 1.0;
-		vTexCoord = texCoord;
-		sunlightEffect = 1.0;
-	}
-	// sky
-	else if(obj == 2) {
-		textureFlag = 1.0;
-		vTexCoord = texCoord;
-		sunlightEffect = 0.2;
-	}
-	// GLUT objects
-	else if(obj == 3) {
-		textureFlag = 0.0;
-		sunlightEffect = 0.4;
-	}
-}
\ No newline at end of file
+	vec3 localPos = pos;
+
+#if OBJ == OBJ_IMPOSTOR
+	// impostors: the quad is turned to the camera about the vertical axis of the tree and shows the baked view
+	// closest to the direction of the camera
+	vec3 center = instance.xyz + vec3(0.0, params.x, 0.0) * instance.w;
+	vec3 toEye = vec3(eyePos.x - center.x, 0.0, eyePos.z - center.z);
+	toEye = length(toEye) > 0.0 ? normalize(toEye) : vec3(0.0, 0.0, 1.0);
+	vec3 right = vec3(toEye.z, 0.0, -toEye.x);
+	localPos = center + (right * pos.x * params.y + vec3(0.0, pos.y * params.z, 0.0)) * instance.w;
+	float viewIndex = mod(round(atan(toEye.x, toEye.z) / 6.2831853 * params.w), params.w);
+	vTexCoord = vec2((viewIndex + pos.x * 0.5 + 0.5) / params.w, pos.y * 0.5 + 0.5);
+#else
+	vTexCoord = texCoord;
+#endif
+
+#if OBJ == OBJ_TERRAIN
+	// terrain: a vertex slides to the surface of the level it vanishes at over the end of the range of the
+	// last level it belongs to - the same for every chunk that shares it
+	float rangeStart = params.x * (exp2(morph.y) - 1.0);
+	float rangeEnd = params.x * (exp2(morph.y + 1.0) - 1.0);
+	float morphStart = rangeEnd - (rangeEnd - rangeStart) * params.y;
+	float morphFactor = clamp((distance(pos.xz, eyePos.xz) - morphStart) / (rangeEnd - morphStart), 0.0, 1.0);
+	localPos.y = mix(pos.y, morph.x, morphFactor);
+#endif
+
+#if OBJ == OBJ_GLUT
+	// parts: every instance carries its own transform and color, trees keep their baked vertex colors
+	mat4 world = partModel;
+#else
+	mat4 world = model;
+#endif
+
+	gl_Position = proj * view * world * vec4(localPos, 1.0);
+	vPos = vec3(world * vec4(localPos, 1.0));
+	vNormal = vec3(world * vec4(normal, 0.0));
+	viewSpace = view * world * vec4(localPos, 1.0);
+
+#if OBJ == OBJ_TREE
+	vertexColor = color;
+#elif OBJ == OBJ_GLUT
+	vertexColor = partColor.rgb * color;
+#else
+	vertexColor = vec3(1.0);
+#endif
+}